@@ -0,0 +1,328 @@
+// camera_rig.cpp : one pipeline / filter chain / thread set per connected camera
+//
+
+#include "camera_rig.h"
+#include "capture_writer.h"
+#include "thread_affinity.h"
+
+#include <librealsense2/rs_advanced_mode.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+// frame number of the Z16 depth in a frameset, used to match and count frames across stages
+static unsigned long long depth_number(const rs2::frameset& fs)
+{
+	return fs.first(RS2_STREAM_DEPTH, RS2_FORMAT_Z16).get_frame_number();
+}
+
+camera_unit::camera_unit(size_t index, rs2::device dev, const std::string& preset, const std::vector<unsigned>& cores,
+	int sync_mode, const rig_options& opt, float min_z, float max_z)
+	: camera_stats("camera " + std::string(dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER))),
+	_index(index),
+	_serial(dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER)),
+	_cores(cores),
+	_processing(min_z, max_z),
+	_ring(opt.ring_frames, opt.ring_bytes)
+{
+	// load preset from json file : advance mode enabled
+	auto advanced_mode_dev = dev.as<rs400::advanced_mode>();
+	if (!advanced_mode_dev.is_enabled())
+		advanced_mode_dev.toggle_advanced_mode(true);
+	if (!preset.empty())
+	{
+		std::ifstream jfile(preset);
+		if (!jfile) std::cout << "Camera " << _serial << " : cannot open preset " << preset << std::endl;
+		std::string str((std::istreambuf_iterator<char>(jfile)), std::istreambuf_iterator<char>());
+		if (!str.empty()) advanced_mode_dev.load_json(str);
+	}
+
+	size_t granted = _ring.max_frames();	// frames every pool the ring pins from grew by
+	for (auto& sensor : dev.query_sensors())
+	{
+		// hardware timestamps mapped onto the host clock, comparable across cameras
+		if (sensor.supports(RS2_OPTION_GLOBAL_TIME_ENABLED))
+		{
+			sensor.set_option(RS2_OPTION_GLOBAL_TIME_ENABLED, 1);
+			if (sensor.is<rs2::depth_sensor>()) _global_time = true;
+		}
+		if (sync_mode >= 0 && sensor.is<rs2::depth_sensor>() && sensor.supports(RS2_OPTION_INTER_CAM_SYNC_MODE))
+			sensor.set_option(RS2_OPTION_INTER_CAM_SYNC_MODE, (float)sync_mode);
+		// the ring pins colour frames straight from the sensor pool, keep the stream supplied;
+		// the depth sensor also supplies the raw frames the averaging thread holds, which come first
+		if (sensor.supports(RS2_OPTION_FRAMES_QUEUE_SIZE))
+		{
+			const size_t average = sensor.is<rs2::depth_sensor>() ? _average.pinned_frames() : 0;
+			auto range = sensor.get_option_range(RS2_OPTION_FRAMES_QUEUE_SIZE);
+			float size = sensor.get_option(RS2_OPTION_FRAMES_QUEUE_SIZE);
+			float grown = std::min(size + (float)(_ring.max_frames() + average), range.max);
+			sensor.set_option(RS2_OPTION_FRAMES_QUEUE_SIZE, grown);
+			size_t got = (size_t)std::max(0.f, grown - size);
+			granted = std::min(granted, got > average ? got - average : 0);
+		}
+	}
+	_depth_scale = dev.first<rs2::depth_sensor>().get_depth_scale();
+	_processing.set_cores(cores);
+	granted = std::min(granted, _processing.reserve_frames(_ring.max_frames()));
+
+	// pools are capped : a ring pinning more frames than they grew by would starve the stream
+	if (granted < _ring.max_frames())
+	{
+		std::cout << "Camera " << _serial << " : frame pools grow by " << granted << " frames only, ring cut from "
+			<< _ring.max_frames() << " to " << std::max<size_t>(1, granted) << " frames" << std::endl;
+		_ring.set_max_frames(granted);
+	}
+}
+
+camera_unit::camera_unit(size_t index, const std::string& serial, const rig_options& opt, float min_z, float max_z)
+	: camera_stats("camera " + serial),
+	_index(index),
+	_serial(serial),
+	_processing(min_z, max_z),
+	_ring(opt.ring_frames, opt.ring_bytes)
+{
+	// the source owns the sensor pools, only the processing blocks can grow theirs here
+	size_t granted = _processing.reserve_frames(_ring.max_frames());
+	if (granted < _ring.max_frames())
+	{
+		std::cout << "Camera " << _serial << " : frame pools grow by " << granted << " frames only, ring cut from "
+			<< _ring.max_frames() << " to " << std::max<size_t>(1, granted) << " frames" << std::endl;
+		_ring.set_max_frames(granted);
+	}
+}
+
+void camera_unit::start(const rig_options& opt, frames_callback on_frames)
+{
+	rs2::config cfg;
+	cfg.enable_device(_serial);
+	cfg.enable_stream(RS2_STREAM_DEPTH, opt.width, opt.height, RS2_FORMAT_Z16, opt.fps);	// Enable default depth
+	cfg.enable_stream(RS2_STREAM_COLOR, opt.width, opt.height, RS2_FORMAT_RGB8, opt.fps);	// RGB8 Color Stream
+	//Problem same resolution flicker happen in aligned depth
+
+	auto profile = _pipe.start(cfg);
+	_streaming = true;
+	_depth_profile = profile.get_stream(RS2_STREAM_DEPTH);
+
+	// Block until the pipeline delivers a frameset, timeout only to re-check alive
+	const unsigned int timeout_ms = opt.frame_timeout_ms;
+	start_feeding([this, timeout_ms](rs2::frameset& fs) { return _pipe.try_wait_for_frames(&fs, timeout_ms); }, on_frames);
+}
+
+void camera_unit::start(frameset_source source, frames_callback on_frames)
+{
+	start_feeding(source, on_frames);
+}
+
+void camera_unit::start_feeding(frameset_source source, frames_callback on_frames)
+{
+	_processing.start([this, on_frames](rs2::frameset fs) {
+		frame_snapshot snap = depth_pipeline::snapshot(fs);
+		_ring.push(snap);					// pre-trigger / matched capture, pins without copying
+		on_frames(_index, fs, snap);
+	});
+
+	_alive = true;
+	_thread = std::thread([this, source]() {
+		// feeding thread : camera -> align stage (or the whole chain, not pipelined)
+		pin_current_thread(_cores);
+		while (_alive)
+		{
+			rs2::frameset fs;
+			if (source(fs))
+			{
+				camera_stats.arrive(depth_number(fs));
+				_average.offer(fs.get_depth_frame());	// only while an average wants frames
+				_processing.invoke(fs);
+			}
+		}
+	});
+}
+
+void camera_unit::stop()
+{
+	if (!_thread.joinable()) return;
+	_alive = false;
+	_thread.join();
+	_average.stop();
+	_processing.stop();						// frames still queued in the stages reach on_frames
+	if (_streaming) _pipe.stop();
+	_streaming = false;
+}
+
+void camera_unit::print_stats(std::ostream& os) const
+{
+	camera_stats.print(os);
+	if (_processing.pipelined()) _processing.print_stages(os);
+	os << "ring : " << _ring.size() << " frames, " << (_ring.bytes() >> 20) << " MB, pushed " << _ring.pushed()
+		<< ", evicted by size " << _ring.evicted() << std::endl;
+}
+
+camera_rig::camera_rig(rs2::context& ctx, const rig_options& opt, float min_z, float max_z)
+	: _opt(opt)
+{
+	std::vector<rs2::device> devices;
+	for (auto&& dev : ctx.query_devices())
+	{
+		std::string serial = dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+		if (!opt.serials.empty() && std::find(opt.serials.begin(), opt.serials.end(), serial) == opt.serials.end())
+			continue;
+		if (!dev.is<rs400::advanced_mode>())
+		{
+			std::cout << "Camera " << serial << " doesn't support advanced-mode, skipped" << std::endl;
+			continue;
+		}
+		devices.push_back(dev);
+	}
+
+	for (size_t i = 0; i < devices.size(); i++)
+	{
+		std::string serial = devices[i].get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+		auto preset = opt.presets.find(serial);
+		auto cores = opt.cores.find(serial);
+		std::vector<unsigned> pinned = cores != opt.cores.end() ? cores->second :
+			opt.split_cores ? split_cores((unsigned)i, (unsigned)devices.size()) : std::vector<unsigned>();
+		int sync_mode = opt.sync_master.empty() ? -1 : serial == opt.sync_master ? 1 : 2;
+
+		_units.emplace_back(new camera_unit(i, devices[i], preset != opt.presets.end() ? preset->second : opt.preset,
+			pinned, sync_mode, opt, min_z, max_z));
+		std::cout << "Camera " << serial << " : advance mode enabled";
+		if (!pinned.empty()) std::cout << ", cores " << pinned.front() << "-" << pinned.back();
+		if (sync_mode > 0) std::cout << (sync_mode == 1 ? ", sync master" : ", sync slave");
+		if (!_units.back()->global_time()) std::cout << ", no global time (timestamps not comparable)";
+		std::cout << std::endl;
+	}
+}
+
+camera_rig::camera_rig(std::vector<std::unique_ptr<camera_unit>> units, const rig_options& opt)
+	: _opt(opt),
+	_units(std::move(units))
+{
+}
+
+void camera_rig::start(camera_unit::frames_callback on_frames)
+{
+	for (auto& unit : _units) unit->start(_opt, on_frames);
+}
+
+void camera_rig::stop()
+{
+	for (auto& unit : _units) unit->stop();
+}
+
+std::vector<std::vector<frame_snapshot>> camera_rig::histories() const
+{
+	std::vector<std::vector<frame_snapshot>> out;
+	for (auto& unit : _units) out.push_back(unit->ring().history());
+	return out;
+}
+
+std::vector<frame_snapshot> camera_rig::match(const std::vector<std::vector<frame_snapshot>>& histories,
+	double reference, double* skew_ms)
+{
+	std::vector<frame_snapshot> snaps;
+	double lo = 0, hi = 0;
+	bool first = true;
+	for (auto& h : histories)
+	{
+		snaps.push_back(nearest_snapshot(h, reference));
+		if (!snaps.back()) continue;
+		lo = first ? snaps.back().timestamp : std::min(lo, snaps.back().timestamp);
+		hi = first ? snaps.back().timestamp : std::max(hi, snaps.back().timestamp);
+		first = false;
+	}
+	if (skew_ms) *skew_ms = hi - lo;
+	return snaps;
+}
+
+std::vector<frame_snapshot> camera_rig::matched(double* skew_ms) const
+{
+	auto h = histories();
+
+	// the newest time every camera has reached : newest frame of the camera that lags most
+	double reference = 0;
+	bool any = false;
+	for (auto& frames : h)
+	{
+		if (frames.empty()) continue;
+		reference = any ? std::min(reference, frames.back().timestamp) : frames.back().timestamp;
+		any = true;
+	}
+	return match(h, reference, skew_ms);
+}
+
+std::vector<std::vector<frame_snapshot>> camera_rig::matched_window(unsigned before, unsigned after, double* skew_ms) const
+{
+	std::vector<std::vector<frame_snapshot>> sets;
+	if (_units.empty()) return sets;
+
+	// T : newest frame of the first camera when the trigger is seen
+	unsigned long long t = _units[0]->ring().newest().frame_number;
+	if (!t) return sets;
+	auto period = std::chrono::milliseconds(1000 / std::max(1, _opt.fps));
+	auto frames = _units[0]->ring().range(t > before ? t - before : 1, t + after, period * (after + 2));
+
+	auto h = histories();					// after the wait, so the other cameras have T+k too
+	double worst = 0;
+	for (auto& reference : frames)
+	{
+		double skew = 0;
+		sets.push_back(match(h, reference.timestamp, &skew));
+		sets.back()[0] = reference;			// the first camera's own frame, not its nearest
+		worst = std::max(worst, skew);
+	}
+	if (skew_ms) *skew_ms = worst;
+	return sets;
+}
+
+std::vector<frame_snapshot> camera_rig::matched_best(double window_ms, double* fill, double* skew_ms) const
+{
+	auto h = histories();
+	std::vector<frame_snapshot> best;
+	double best_fill = -1, best_skew = 0;
+	if (h.empty() || h[0].empty())
+	{
+		if (fill) *fill = 0;
+		return matched(skew_ms);
+	}
+
+	// candidates : the first camera's frames of the window, each scored by its worst camera
+	const double newest = h[0].back().timestamp;
+	for (auto& reference : h[0])
+	{
+		if (reference.timestamp < newest - window_ms) continue;
+		double skew = 0;
+		auto set = match(h, reference.timestamp, &skew);
+		set[0] = reference;
+		double worst = 1;
+		for (auto& snap : set) worst = std::min(worst, snap ? depth_fill_rate(snap.depth) : 0.0);
+		if (worst > best_fill)
+		{
+			best_fill = worst;
+			best_skew = skew;
+			best = set;
+		}
+	}
+	if (fill) *fill = best_fill;
+	if (skew_ms) *skew_ms = best_skew;
+	return best;
+}
+
+void camera_rig::print_stats(std::ostream& os) const
+{
+	for (auto& unit : _units) unit->print_stats(os);
+}
+
+void capture_rig(const camera_rig& rig, const std::vector<frame_snapshot>& snaps,
+	const std::chrono::seconds& timstp, const char& workKey, capture_writer& writer, bool tag_frame,
+	std::vector<std::string>* queued)
+{
+	for (size_t i = 0; i < snaps.size() && i < rig.size(); i++)
+	{
+		std::string tag = rig.size() > 1 ? rig[i].serial() : std::string();
+		if (tag_frame && snaps[i]) tag += (tag.empty() ? "f" : "_f") + std::to_string(snaps[i].frame_number);
+		capture_light1(snaps[i], timstp, workKey, writer, tag, queued);
+	}
+}
@@ -0,0 +1,165 @@
+// camera_rig.h : every connected D400, each with its own pipeline, filter chain and threads
+//
+// A camera_unit is one device : an rs2::pipeline bound to its serial number,
+// its advanced-mode preset, a depth_pipeline and a feeding thread, all pinned
+// to the camera's own cores. Units share nothing on the frame path, so N
+// cameras cost N times one camera instead of contending for one chain.
+//
+// Frames of different cameras are matched by timestamp : global time is
+// turned on where the firmware supports it, which maps every camera's
+// hardware timestamp onto the host clock. Free running, matched frames are
+// up to half a frame period apart; with one camera as inter-cam sync master
+// and the others as slaves they are exposed together.
+//
+// Each camera keeps a frame_ring of its last snapshots, so a trigger can take
+// a matched set around the key press (T-k .. T+k) or the most complete set of
+// the last few hundred milliseconds instead of only the newest frames.
+//
+// The feeding thread also hands raw depth frames to the camera's
+// depth_average while an average capture runs.
+//
+// replay_bench builds a rig of one replay unit : no device, its feeding thread
+// takes the framesets of a .bag or synthetic source instead of a pipeline, so
+// triggers and averages take the same path as with a camera.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "depth_average.h"
+#include "depth_pipeline.h"
+#include "frame_ring.h"
+#include "frame_snapshot.h"
+#include "frame_stats.h"
+
+class capture_writer;
+
+struct rig_options
+{
+	std::vector<std::string> serials;		// open only these, empty = every connected device
+	std::string preset = "Labv1_defaultBased_01mm_LightLowest.json";	// cameras without their own
+	std::map<std::string, std::string> presets;			// serial -> advanced-mode json
+	std::map<std::string, std::vector<unsigned>> cores;	// serial -> cores of its threads
+	bool split_cores = false;				// cameras without cores : even share of the hardware threads
+	std::string sync_master;				// inter-cam sync master, the others slave; empty = free running
+	int width = 1280, height = 720, fps = 30;	// Z16 depth and RGB8 colour
+	unsigned int frame_timeout_ms = 100;	// blocking wait, bounds how late a feeding thread sees stop()
+	size_t ring_frames = 16;				// pre-trigger ring per camera : snapshots ...
+	size_t ring_bytes = 160u << 20;			// ... and the pixel bytes they pin
+};
+
+class camera_unit
+{
+public:
+	// on_frames : composite frameset of camera index, on its colorize (or feeding) thread
+	typedef std::function<void(size_t index, rs2::frameset fs, const frame_snapshot& snap)> frames_callback;
+	// replay : next frameset on the feeding thread; false when there is none after waiting a
+	// little (like frame_timeout_ms, the thread re-checks stop() in between)
+	typedef std::function<bool(rs2::frameset& fs)> frameset_source;
+
+	// enables advanced mode, loads the preset and the sync mode (0 default, 1 master, 2 slave, -1 = leave),
+	// grows the sensor and processing frame pools by the ring size, the depth sensor's also by
+	// the frames depth_average may hold
+	camera_unit(size_t index, rs2::device dev, const std::string& preset, const std::vector<unsigned>& cores,
+		int sync_mode, const rig_options& opt, float min_z, float max_z);
+	// replay unit : no device, grows the processing frame pools by the ring size
+	camera_unit(size_t index, const std::string& serial, const rig_options& opt, float min_z, float max_z);
+	~camera_unit() { stop(); }
+
+	const std::string& serial() const { return _serial; }
+	depth_pipeline& processing() { return _processing; }
+	const std::vector<unsigned>& cores() const { return _cores; }
+	bool global_time() const { return _global_time; }
+	float depth_scale() const { return _depth_scale; }
+
+	// valid after start() with a device
+	rs2::video_stream_profile depth_profile() const { return _depth_profile.as<rs2::video_stream_profile>(); }
+
+	// configure processing() first
+	void start(const rig_options& opt, frames_callback on_frames);
+	void start(frameset_source source, frames_callback on_frames);	// replay unit
+	void stop();							// joins the feeding thread, drains the stages, stops streaming
+
+	// pre-trigger ring, filled from the colorize thread
+	const frame_ring& ring() const { return _ring; }
+
+	// averages raw depth frames from the feeding thread, stop() cancels a running one
+	depth_average& average() { return _average; }
+
+	void print_stats(std::ostream& os) const;
+	stage_stats camera_stats;				// frames lost before the feeding thread
+
+private:
+	void start_feeding(frameset_source source, frames_callback on_frames);
+
+	size_t _index;
+	std::string _serial;
+	std::vector<unsigned> _cores;
+	bool _global_time = false;
+	float _depth_scale = 0.001f;
+	rs2::stream_profile _depth_profile;
+
+	depth_pipeline _processing;
+	rs2::pipeline _pipe;
+	bool _streaming = false;				// _pipe started
+	frame_ring _ring;
+	depth_average _average;
+	std::atomic_bool _alive{ false };
+	std::thread _thread;
+};
+
+class camera_rig
+{
+public:
+	// opens the devices of ctx that support advanced mode (others are skipped with a message)
+	camera_rig(rs2::context& ctx, const rig_options& opt, float min_z, float max_z);
+	// units built by the caller (replay)
+	camera_rig(std::vector<std::unique_ptr<camera_unit>> units, const rig_options& opt);
+
+	size_t size() const { return _units.size(); }
+	const rig_options& options() const { return _opt; }
+	camera_unit& operator[](size_t i) { return *_units[i]; }
+	const camera_unit& operator[](size_t i) const { return *_units[i]; }
+
+	void start(camera_unit::frames_callback on_frames);
+	void stop();
+
+	// one snapshot per camera, all nearest to the newest time every camera has reached;
+	// an empty snapshot for a camera without frames. skew_ms : spread of the timestamps
+	std::vector<frame_snapshot> matched(double* skew_ms = nullptr) const;
+
+	// matched sets for the frames of the first camera from before frames ahead of its newest
+	// frame (T) to after frames past it, oldest first; waits for the frames after T
+	std::vector<std::vector<frame_snapshot>> matched_window(unsigned before, unsigned after, double* skew_ms = nullptr) const;
+
+	// the matched set of the last window_ms whose least complete camera has the highest
+	// depth fill rate; fill : that rate
+	std::vector<frame_snapshot> matched_best(double window_ms, double* fill = nullptr, double* skew_ms = nullptr) const;
+
+	void print_stats(std::ostream& os) const;
+
+private:
+	std::vector<std::vector<frame_snapshot>> histories() const;
+	static std::vector<frame_snapshot> match(const std::vector<std::vector<frame_snapshot>>& histories,
+		double reference, double* skew_ms);
+
+	rig_options _opt;
+	std::vector<std::unique_ptr<camera_unit>> _units;
+};
+
+// Queue the files for one trigger key on every camera from one matched set; with several
+// cameras the serial number goes into the file names, with tag_frame the frame number
+// (several sets from one trigger); queued collects the names of the queued files
+void capture_rig(const camera_rig& rig, const std::vector<frame_snapshot>& snaps,
+	const std::chrono::seconds& timstp, const char& workKey, capture_writer& writer, bool tag_frame = false,
+	std::vector<std::string>* queued = nullptr);
@@ -0,0 +1,186 @@
+// capture_writer.cpp : encoder pool for captured frames
+//
+
+#include "capture_writer.h"
+#include "depth_codec.h"
+#include "frame_telemetry.h"
+
+// stb library
+#define STBI_MSC_SECURE_CRT
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../stb_image_write_109.h" //v1.09 nothing_stb
+// opencv for imwrite
+#include <opencv2/opencv.hpp>
+
+#include <iostream>
+#include <sstream>
+
+capture_writer::capture_writer(size_t capacity, size_t workers, completion_callback on_done)
+	: _capacity(capacity), _on_done(on_done)
+{
+	if (!workers) workers = 1;
+	for (size_t i = 0; i < workers; i++)
+		_workers.emplace_back([this]() { worker(); });
+}
+
+capture_writer::~capture_writer()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_work_cv.notify_all();
+	for (auto& t : _workers) t.join();
+}
+
+bool capture_writer::submit(capture_job job)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_stopping || _jobs.size() >= _capacity)
+		{
+			_rejected++;
+			return false;
+		}
+		_jobs.push_back(std::move(job));
+	}
+	_work_cv.notify_one();
+	return true;
+}
+
+void capture_writer::flush()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	_idle_cv.wait(lock, [this]() { return _jobs.empty() && !_in_progress; });
+}
+
+size_t capture_writer::pending() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _jobs.size() + _in_progress;
+}
+
+void capture_writer::worker()
+{
+	while (true)
+	{
+		capture_job job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_work_cv.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+			if (_jobs.empty()) return;		// stopping and drained
+			job = std::move(_jobs.front());
+			_jobs.pop_front();
+			_in_progress++;
+		}
+
+		bool ok = encode(job);
+		if (!ok) _failed++;
+		if (_on_done) _on_done(job, ok);
+
+		job.frame = rs2::frame();			// release the pinned frame before reporting idle
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_in_progress--;
+			if (_jobs.empty() && !_in_progress) _idle_cv.notify_all();
+		}
+	}
+}
+
+bool capture_writer::encode(const capture_job& job)
+{
+	if (job.format == capture_job::csv_metadata)
+		return metadata_to_csv(job.frame, job.filename);
+
+	auto vf = job.frame.as<rs2::video_frame>();
+	if (!vf) return false;
+
+	if (job.format == capture_job::png_rgb8)
+	{
+		return stbi_write_png(
+			job.filename.c_str(),
+			vf.get_width(),
+			vf.get_height(),
+			vf.get_bytes_per_pixel(),
+			vf.get_data(),
+			vf.get_stride_in_bytes()
+		) != 0;
+	}
+	else if (job.format == capture_job::rvl_z16)
+	{
+		auto df = job.frame.as<rs2::depth_frame>();
+		return rvl_write_file(job.filename, (const uint16_t*)vf.get_data(), vf.get_width(), vf.get_height(),
+			vf.get_stride_in_bytes(), df ? df.get_units() : 0.f, vf.get_frame_number(), vf.get_timestamp());
+	}
+	else if (job.format == capture_job::tiff_f32)
+	{
+		cv::Mat meters(cv::Size(vf.get_width(), vf.get_height()), CV_32FC1, (void*)vf.get_data(), vf.get_stride_in_bytes());
+		return cv::imwrite(cv::String(job.filename), meters);
+	}
+	else
+	{
+		cv::Mat depth16(cv::Size(vf.get_width(), vf.get_height()), CV_16UC1, (void*)vf.get_data(), vf.get_stride_in_bytes());
+		return cv::imwrite(cv::String(job.filename), depth16);
+	}
+}
+
+void capture_light1(const frame_snapshot& snap, 
+					const std::chrono::seconds& timstp,
+					const char& workKey,
+					capture_writer& writer,
+					const std::string& camera,
+					std::vector<std::string>* queued) 
+{
+	// queue frame individually png file, the encoder pool writes it
+	// save metadata and rs_intrinsic
+	if (!snap)
+	{
+		std::cout << "No frame to capture yet" << std::endl;
+		return;
+	}
+	auto depth_capfrm = snap.colorized.as<rs2::video_frame>();
+	auto color_capfrm = snap.color.as<rs2::video_frame>();
+	auto rawDepth = snap.depth.as<rs2::depth_frame>();
+	std::cout << "Capture frame #" << snap.frame_number;
+	if (!camera.empty()) std::cout << " (camera " << camera << ")";
+	std::cout << std::endl;
+	const std::string prefix = camera.empty() ? std::string() : "_" + camera;
+	
+	std::stringstream depth_filename;
+	std::stringstream color_filename1;
+	std::stringstream color_filename2;
+	std::stringstream rawDepth_filename;
+	std::stringstream depth_metadata_filename;
+	std::stringstream color_metadata_filename;
+
+	depth_filename  << "output_image/"<<timstp.count() << prefix << "_depth-u8-" << depth_capfrm.get_profile().stream_name() << ".png";
+	color_filename1 << "output_image/"<<timstp.count() << prefix << "_RGB-1_" << color_capfrm.get_profile().stream_name() << ".png";
+	color_filename2 << "output_image/"<<timstp.count() << prefix << "_RGB-2_" << color_capfrm.get_profile().stream_name() << ".png";
+	const bool rvl = writer.depth_format() == capture_job::rvl_z16;
+	rawDepth_filename <<"output_image/" <<timstp.count() << prefix << "_depth-u16_" << rawDepth.get_profile().stream_name() << (rvl ? ".rvl" : ".png");
+	depth_metadata_filename << "output_image/" << timstp.count() << prefix << "_metadata_" << rawDepth.get_profile().stream_name() << ".csv";
+	color_metadata_filename << "output_image/" << timstp.count() << prefix << "_metadata_" << color_capfrm.get_profile().stream_name() << ".csv";
+
+	std::vector<capture_job> jobs;
+	if (workKey == '1')
+		jobs.push_back({ color_capfrm, color_filename1.str(), capture_job::png_rgb8 });
+	if (workKey == '2')
+		jobs.push_back({ color_capfrm, color_filename2.str(), capture_job::png_rgb8 });
+	if (workKey == '1' || workKey == '2')
+		jobs.push_back({ color_capfrm, color_metadata_filename.str(), capture_job::csv_metadata });	// exposure, gain ..
+	if (workKey == 'd')
+	{
+		jobs.push_back({ depth_capfrm, depth_filename.str(), capture_job::png_rgb8 });		// colorized
+		jobs.push_back({ rawDepth, rawDepth_filename.str(), writer.depth_format() });	// 16 bit depth
+		jobs.push_back({ rawDepth, depth_metadata_filename.str(), capture_job::csv_metadata });	// laser power ..
+	}
+
+	for (auto& job : jobs)
+	{
+		std::string fname = job.filename;
+		if (!writer.submit(std::move(job)))
+			std::cout << "Capture queue full, dropped : " << fname << std::endl;
+		else if (queued)
+			queued->push_back(fname);
+	}
+}
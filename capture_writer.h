@@ -0,0 +1,96 @@
+// capture_writer.h : asynchronous capture writer
+//
+// The trigger thread only pins the frames (rs2::frame is reference counted)
+// and queues one job per file. A pool of encoder threads does the PNG
+// compression and the file I/O, so trigger-to-return latency does not depend
+// on the disk.
+//
+// Raw depth is written as .rvl (depth_codec.h) by default : lossless, a few
+// ms per 1280x720 frame where a 16 bit PNG takes tens of ms. depth_convert
+// turns .rvl files into 16 bit PNG for tools that need them.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include "frame_snapshot.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct capture_job
+{
+	enum format_type
+	{
+		png_rgb8,		// 8 bit RGB (colour or colorized depth) through stb
+		png_z16,		// 16 bit grayscale depth through opencv
+		rvl_z16,		// 16 bit depth, RVL compressed (depth_codec.h)
+		csv_metadata,	// every supported metadata value of the frame (metadata_to_csv)
+		tiff_f32		// 32 bit float (averaged depth in meters) through opencv
+	};
+
+	rs2::frame frame;		// holds a reference, pixel data stays valid until the job is done
+	std::string filename;
+	format_type format;
+};
+
+class capture_writer
+{
+public:
+	// called from an encoder thread once the file is written (ok) or failed
+	typedef std::function<void(const capture_job&, bool ok)> completion_callback;
+
+	// capacity : max jobs waiting for an encoder, bounds the number of pinned frames
+	capture_writer(size_t capacity, size_t workers, completion_callback on_done);
+	~capture_writer();						// finishes queued jobs, then joins the pool
+
+	// Never blocks : returns false and counts a rejected job when the queue is full
+	bool submit(capture_job job);
+
+	void flush();							// wait until every submitted job is written
+	size_t pending() const;					// queued + in progress
+	size_t capacity() const { return _capacity; }
+	unsigned long long rejected() const { return _rejected; }
+	unsigned long long failed() const { return _failed; }		// encode or write errors
+
+	// format of the raw depth files capture_light1 queues : rvl_z16 (default) or png_z16
+	void set_depth_format(capture_job::format_type format) { _depth_format = format; }
+	capture_job::format_type depth_format() const { return _depth_format; }
+
+private:
+	void worker();
+	static bool encode(const capture_job& job);
+
+	const size_t _capacity;
+	completion_callback _on_done;
+	std::atomic<capture_job::format_type> _depth_format{ capture_job::rvl_z16 };
+
+	mutable std::mutex _mutex;
+	std::condition_variable _work_cv;		// jobs available / stopping
+	std::condition_variable _idle_cv;		// pending reached zero
+	std::deque<capture_job> _jobs;
+	size_t _in_progress = 0;
+	bool _stopping = false;
+
+	std::atomic<unsigned long long> _rejected{ 0 };
+	std::atomic<unsigned long long> _failed{ 0 };
+	std::vector<std::thread> _workers;
+};
+
+// Queue the files for one trigger key ('1' / '2' : colour, 'd' : colorized + 16 bit depth,
+// .rvl or .png after writer.depth_format()) and the metadata csv of the raw frame,
+// names are built from the timestamper seconds and the camera tag (serial number, may be
+// empty). Returns as soon as the jobs are queued; the names of the queued files are
+// appended to queued when given.
+void capture_light1(const frame_snapshot& snap, const std::chrono::seconds& timstp, const char& workKey, capture_writer& writer,
+	const std::string& camera = std::string(), std::vector<std::string>* queued = nullptr);
+
+// files capture_light1 queues for one snapshot of workKey
+inline size_t capture_files(char workKey) { return workKey == 'd' ? 3 : 2; }
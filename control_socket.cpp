@@ -0,0 +1,269 @@
+// control_socket.cpp : line-based command server on an AF_UNIX socket
+//
+
+#include "control_socket.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef SOCKET socket_type;
+static const socket_type no_socket = INVALID_SOCKET;
+static void close_socket(socket_type s) { closesocket(s); }
+static void remove_path(const std::string& path) { DeleteFileA(path.c_str()); }
+#else
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int socket_type;
+static const socket_type no_socket = -1;
+static void close_socket(socket_type s) { close(s); }
+static void remove_path(const std::string& path) { unlink(path.c_str()); }
+#endif
+
+#ifdef MSG_NOSIGNAL
+static const int send_flags = MSG_NOSIGNAL;		// a client gone mid-reply is an error, not SIGPIPE
+#else
+static const int send_flags = 0;
+#endif
+
+static const size_t max_line = 4096;	// a client sending more without a line end is dropped
+static const size_t max_clients = 16;
+
+// winsock needs WSAStartup before the first socket call of the process
+static void socket_startup()
+{
+#ifdef _WIN32
+	struct winsock
+	{
+		winsock() { WSADATA data; WSAStartup(MAKEWORD(2, 2), &data); }
+		~winsock() { WSACleanup(); }
+	};
+	static winsock started;
+	(void)started;
+#endif
+}
+
+static bool make_address(const std::string& path, sockaddr_un& addr)
+{
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+	memcpy(addr.sun_path, path.c_str(), path.size());
+	return true;
+}
+
+static bool send_all(socket_type s, const std::string& data)
+{
+	size_t sent = 0;
+	while (sent < data.size())
+	{
+		int n = (int)send(s, data.data() + sent, (int)(data.size() - sent), send_flags);
+		if (n <= 0) return false;
+		sent += (size_t)n;
+	}
+	return true;
+}
+
+control_command parse_control_command(const std::string& line)
+{
+	control_command cmd;
+	std::istringstream in(line);
+	std::string word, extra;
+	if (!(in >> word)) return cmd;
+
+	if (word == "1" || word == "2" || word == "d")
+	{
+		cmd.kind = control_command::capture;
+		cmd.key = word[0];
+	}
+	else if (word == "capture")
+	{
+		long long count = 0;
+		std::string key = "d";
+		if (!(in >> count) || count < 1) return cmd;
+		in >> key;
+		if (key != "1" && key != "2" && key != "d") return cmd;
+		cmd.kind = control_command::capture;
+		cmd.count = (unsigned)std::min(count, 1000000LL);
+		cmd.key = key[0];
+	}
+	else if (word == "average")
+	{
+		long long count = 0;
+		if (!(in >> count) || count < 1) return cmd;
+		cmd.kind = control_command::average;
+		cmd.count = (unsigned)std::min(count, 65535LL);	// samples map is 16 bit
+	}
+	else if (word == "t") cmd.kind = control_command::timestamp;
+	else if (word == "quit") cmd.kind = control_command::quit;
+
+	if (in >> extra) cmd.kind = control_command::invalid;	// trailing words
+	return cmd;
+}
+
+control_socket::control_socket(const std::string& path, command_handler handler)
+	: _path(path), _handler(handler), _listener((intptr_t)no_socket)
+{
+	socket_startup();
+	sockaddr_un addr;
+	if (!make_address(path, addr)) throw std::runtime_error("control socket path too long : " + path);
+
+	socket_type s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s == no_socket) throw std::runtime_error("cannot create control socket");
+	remove_path(path);					// left over by a previous run that did not exit cleanly
+	if (bind(s, (const sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 4) != 0)
+	{
+		close_socket(s);
+		throw std::runtime_error("cannot listen on " + path);
+	}
+	_listener = (intptr_t)s;
+	std::cout << "Control socket : " << path << std::endl;
+	_thread = std::thread([this]() { serve(); });
+}
+
+control_socket::~control_socket()
+{
+	_alive = false;
+	if (_thread.joinable()) _thread.join();
+	close_socket((socket_type)_listener);
+	remove_path(_path);
+}
+
+void control_socket::serve()
+{
+	struct client
+	{
+		socket_type s;
+		std::string pending;			// received, no line end yet
+	};
+	std::vector<client> clients;
+	const socket_type listener = (socket_type)_listener;
+
+	while (_alive)
+	{
+		// timeout only to re-check alive
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(listener, &readable);
+		socket_type highest = listener;
+		for (auto& c : clients)
+		{
+			FD_SET(c.s, &readable);
+			highest = std::max(highest, c.s);
+		}
+		timeval timeout = { 0, 100000 };
+		if (select((int)highest + 1, &readable, nullptr, nullptr, &timeout) <= 0) continue;
+
+		if (FD_ISSET(listener, &readable))
+		{
+			socket_type s = accept(listener, nullptr, nullptr);
+			if (s != no_socket)
+			{
+				if (clients.size() < max_clients) clients.push_back({ s, std::string() });
+				else
+				{
+					send_all(s, "ERR too many clients\n");
+					close_socket(s);
+				}
+			}
+		}
+
+		for (size_t i = 0; i < clients.size(); )
+		{
+			client& c = clients[i];
+			bool keep = true;
+			if (FD_ISSET(c.s, &readable))
+			{
+				char buf[512];
+				int n = (int)recv(c.s, buf, sizeof(buf), 0);
+				if (n <= 0) keep = false;		// closed by the client
+				else
+				{
+					c.pending.append(buf, (size_t)n);
+					size_t end;
+					while (keep && (end = c.pending.find('\n')) != std::string::npos)
+					{
+						std::string line = c.pending.substr(0, end);
+						c.pending.erase(0, end + 1);
+						if (!line.empty() && line.back() == '\r') line.pop_back();
+						if (line.empty()) continue;
+						_commands++;
+						keep = send_all(c.s, _handler(line));
+					}
+					if (keep && c.pending.size() > max_line)
+					{
+						send_all(c.s, "ERR line too long\n");
+						keep = false;
+					}
+				}
+			}
+			if (keep) i++;
+			else
+			{
+				close_socket(c.s);
+				clients.erase(clients.begin() + i);
+			}
+		}
+	}
+	for (auto& c : clients) close_socket(c.s);
+}
+
+std::string control_request(const std::string& path, const std::string& command, unsigned timeout_ms)
+{
+	socket_startup();
+	sockaddr_un addr;
+	if (!make_address(path, addr)) return "ERR bad socket path\n";
+	socket_type s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s == no_socket) return "ERR cannot create socket\n";
+	if (connect(s, (const sockaddr*)&addr, sizeof(addr)) != 0 || !send_all(s, command + "\n"))
+	{
+		close_socket(s);
+		return "ERR cannot reach " + path + "\n";
+	}
+
+	// read until a complete line starting with OK / ERR
+	std::string reply;
+	size_t line_start = 0;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+	while (true)
+	{
+		size_t end;
+		while ((end = reply.find('\n', line_start)) != std::string::npos)
+		{
+			bool last = reply.compare(line_start, 2, "OK") == 0 || reply.compare(line_start, 3, "ERR") == 0;
+			line_start = end + 1;
+			if (last)
+			{
+				close_socket(s);
+				return reply.substr(0, line_start);
+			}
+		}
+
+		auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+		if (left <= 0) break;
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(s, &readable);
+		timeval timeout = { (long)(left / 1000000), (long)(left % 1000000) };
+		if (select((int)s + 1, &readable, nullptr, nullptr, &timeout) <= 0) break;
+		char buf[512];
+		int n = (int)recv(s, buf, sizeof(buf), 0);
+		if (n <= 0) break;
+		reply.append(buf, (size_t)n);
+	}
+	close_socket(s);
+	return reply + "ERR no reply\n";
+}
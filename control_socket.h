@@ -0,0 +1,67 @@
+// control_socket.h : capture commands over a local (Unix domain) socket
+//
+// Replaces the console key for unattended line PCs : a PLC gateway or a
+// script connects to the socket and sends one command per line
+//
+//   1 | 2 | d           capture like the console key (colour light 1 / 2, depth)
+//   capture N [1|2|d]   N consecutive frames from the trigger on, default d
+//   average N           one low-noise depth capture averaged over the next N raw frames
+//   t                   new timestamp for the file names
+//   quit                stop the application
+//
+// Each command gets zero or more information lines ("frame <n> camera <serial>",
+// "file <path>", ...) and ends with one line starting with "OK" or "ERR".
+// Commands of all clients run one at a time on the server thread, in order.
+//
+// AF_UNIX stream socket : POSIX, and Windows 10 1803+ through winsock.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+
+struct control_command
+{
+	enum kind_type { invalid, capture, average, timestamp, quit };
+
+	kind_type kind = invalid;
+	char key = 'd';						// capture : '1', '2' or 'd'
+	unsigned count = 1;					// capture : consecutive frames, average : frames averaged
+};
+
+// a command line without its line end; invalid when it does not parse
+control_command parse_control_command(const std::string& line);
+
+class control_socket
+{
+public:
+	// returns the reply, information lines then the OK / ERR line, each ending with '\n'
+	typedef std::function<std::string(const std::string& line)> command_handler;
+
+	// binds path (a stale socket file there is removed) and starts the server thread;
+	// throws std::runtime_error
+	control_socket(const std::string& path, command_handler handler);
+	~control_socket();					// stops accepting, closes the clients, removes the socket file
+	control_socket(const control_socket&) = delete;
+	control_socket& operator=(const control_socket&) = delete;
+
+	const std::string& path() const { return _path; }
+	unsigned long long commands() const { return _commands; }
+
+private:
+	void serve();
+
+	std::string _path;
+	command_handler _handler;
+	intptr_t _listener;					// SOCKET / file descriptor
+	std::atomic<bool> _alive{ true };
+	std::atomic<unsigned long long> _commands{ 0 };
+	std::thread _thread;
+};
+
+// client side : sends one command and returns the reply up to and including the OK / ERR
+// line, or an "ERR ..." line of its own when the server cannot be reached or times out
+std::string control_request(const std::string& path, const std::string& command, unsigned timeout_ms = 5000);
@@ -0,0 +1,270 @@
+// depth_average.cpp : running per-pixel mean / variance over N depth frames
+//
+
+#include "depth_average.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define AVG_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Welford : n += 1, mean += (z - mean) / n, m2 += (z - mean_old) * (z - mean_new), for z != 0.
+// Both kernels do the same float operations in the same order, so they give the same bits as
+// long as the compiler does not fuse a multiply and an add into an FMA (GCC does by default with
+// -march supporting FMA) : CMakeLists.txt builds this file with -ffp-contract=off, MSVC only
+// contracts with /fp:fast or /fp:contract. --verify-average checks it.
+static void add_row_scalar(const uint16_t* z, float* mean, float* m2, float* count, int x, int width)
+{
+	for (; x < width; x++)
+	{
+		if (!z[x]) continue;				// no depth
+		const float v = (float)z[x];
+		const float n = count[x] + 1.f;
+		const float delta = v - mean[x];
+		mean[x] += delta / n;
+		m2[x] += delta * (v - mean[x]);
+		count[x] = n;
+	}
+}
+
+#ifdef AVG_SSE2
+// 8 pixels a step : invalid lanes keep their state through the valid mask
+static int add_row_sse2(const uint16_t* z, float* mean, float* m2, float* count, int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 one = _mm_set1_ps(1.f);
+	int x = 0;
+	for (; x + 8 <= width; x += 8)
+	{
+		const __m128i d = _mm_loadu_si128((const __m128i*)(z + x));
+		const __m128i halves[2] = { _mm_unpacklo_epi16(d, zero), _mm_unpackhi_epi16(d, zero) };
+		for (int h = 0; h < 2; h++)
+		{
+			const int i = x + 4 * h;
+			const __m128 v = _mm_cvtepi32_ps(halves[h]);
+			const __m128 valid = _mm_castsi128_ps(_mm_cmpgt_epi32(halves[h], zero));
+			const __m128 n = _mm_add_ps(_mm_loadu_ps(count + i), _mm_and_ps(valid, one));
+			const __m128 m = _mm_loadu_ps(mean + i);
+			const __m128 delta = _mm_sub_ps(v, m);
+			const __m128 m_new = _mm_add_ps(m, _mm_and_ps(valid, _mm_div_ps(delta, _mm_max_ps(n, one))));
+			const __m128 m2_new = _mm_add_ps(_mm_loadu_ps(m2 + i), _mm_and_ps(valid, _mm_mul_ps(delta, _mm_sub_ps(v, m_new))));
+			_mm_storeu_ps(count + i, n);
+			_mm_storeu_ps(mean + i, m_new);
+			_mm_storeu_ps(m2 + i, m2_new);
+		}
+	}
+	return x;
+}
+#endif
+
+depth_average::depth_average(size_t queue_frames)
+	: _queue(queue_frames),
+	_finish_block([this](rs2::frame f, rs2::frame_source& source) { finish(f.as<rs2::video_frame>(), source); })
+{
+#ifdef AVG_SSE2
+	_best_kernel = _kernel = kernel_sse2;
+#else
+	_best_kernel = _kernel = kernel_scalar;
+#endif
+	_finish_block.start([](rs2::frame) {});	// finish() keeps its frames, nothing is sent on
+	_thread = std::thread([this]() { worker(); });
+}
+
+bool depth_average::start(unsigned frames, unsigned min_valid, done_callback on_done)
+{
+	bool idle = false;
+	if (!frames || !_thread.joinable() || !_busy.compare_exchange_strong(idle, true)) return false;
+	_frames = frames;
+	_min_valid = min_valid ? std::min(min_valid, frames) : std::max(1u, frames / 2);
+	_on_done = on_done;
+	_skipped_base = _skipped;
+	_wanted = frames;						// from here on the feeding thread hands frames over
+	return true;
+}
+
+void depth_average::offer(const rs2::frame& depth)
+{
+	if (!_wanted.load()) return;			// the common case, one atomic load
+	if (!depth.is<rs2::depth_frame>()) return;
+	if (_queue.offer(depth)) _wanted--;
+	else _skipped++;						// averaging thread behind, a later frame takes its place
+}
+
+void depth_average::stop()
+{
+	if (!_thread.joinable()) return;
+	_wanted = 0;
+	_queue.close();
+	_thread.join();
+}
+
+void depth_average::force_kernel(kernel_type k)
+{
+	_kernel = k > _best_kernel ? _best_kernel : k;
+}
+
+const char* depth_average::kernel_name(kernel_type k)
+{
+	return k == kernel_sse2 ? "sse2" : "scalar";
+}
+
+void depth_average::worker()
+{
+	rs2::frame f;
+	while (_queue.pop(f))
+	{
+		auto depth = f.as<rs2::video_frame>();
+		f = rs2::frame();
+		auto t0 = std::chrono::steady_clock::now();
+		add(depth);
+		add_latency.record_us((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - t0).count());
+		if (_added < _frames) continue;
+
+		_finish_block.invoke(depth);		// delivers synchronously : finish() fills _result
+		done(_result);
+	}
+	if (_busy) done(depth_average_result());	// stopped before the last frame
+}
+
+void depth_average::add(const rs2::video_frame& depth)
+{
+	if (!_added)
+	{
+		_width = depth.get_width();
+		_height = depth.get_height();
+		const size_t pixels = (size_t)_width * _height;
+		_mean.assign(pixels, 0.f);			// allocated by the first average, reused after
+		_m2.assign(pixels, 0.f);
+		_count.assign(pixels, 0.f);
+		_first_frame = depth.get_frame_number();
+	}
+	const int w = std::min(_width, depth.get_width()), h = std::min(_height, depth.get_height());
+	const int stride = depth.get_stride_in_bytes();
+	for (int y = 0; y < h; y++)
+	{
+		auto z = (const uint16_t*)((const uint8_t*)depth.get_data() + (size_t)y * stride);
+		const size_t row = (size_t)y * _width;
+		int x = 0;
+#ifdef AVG_SSE2
+		if (_kernel == kernel_sse2) x = add_row_sse2(z, &_mean[row], &_m2[row], &_count[row], w);
+#endif
+		add_row_scalar(z, &_mean[row], &_m2[row], &_count[row], x, w);
+	}
+	_added++;
+}
+
+void depth_average::finish(const rs2::video_frame& last, const rs2::frame_source& source)
+{
+	const int w = _width, h = _height;
+	auto profile = last.get_profile();
+	if (profile.unique_id() != _meters_profile_source)
+	{
+		_meters_profile = profile.clone(profile.stream_type(), profile.stream_index(), RS2_FORMAT_DISTANCE);
+		_meters_profile_source = profile.unique_id();
+	}
+	auto depth_df = last.as<rs2::depth_frame>();
+	const float units = depth_df ? depth_df.get_units() : 0.001f;
+
+	// metadata and timestamps of the last frame averaged
+	auto depth = source.allocate_video_frame(profile, last, 2, w, h, w * 2, RS2_EXTENSION_DEPTH_FRAME).as<rs2::video_frame>();
+	auto meters = source.allocate_video_frame(_meters_profile, last, 4, w, h, w * 4, RS2_EXTENSION_VIDEO_FRAME).as<rs2::video_frame>();
+	auto deviation = source.allocate_video_frame(profile, last, 2, w, h, w * 2, RS2_EXTENSION_VIDEO_FRAME).as<rs2::video_frame>();
+	auto samples = source.allocate_video_frame(profile, last, 2, w, h, w * 2, RS2_EXTENSION_VIDEO_FRAME).as<rs2::video_frame>();
+
+	const float min_valid = (float)_min_valid;
+	size_t valid = 0;
+	double deviation_sum = 0;
+	for (int y = 0; y < h; y++)
+	{
+		auto d = (uint16_t*)((uint8_t*)depth.get_data() + (size_t)y * depth.get_stride_in_bytes());
+		auto m = (float*)((uint8_t*)meters.get_data() + (size_t)y * meters.get_stride_in_bytes());
+		auto s = (uint16_t*)((uint8_t*)deviation.get_data() + (size_t)y * deviation.get_stride_in_bytes());
+		auto c = (uint16_t*)((uint8_t*)samples.get_data() + (size_t)y * samples.get_stride_in_bytes());
+		const size_t row = (size_t)y * _width;
+		for (int x = 0; x < w; x++)
+		{
+			const float n = _count[row + x];
+			c[x] = (uint16_t)std::min(n, 65535.f);
+			if (n < min_valid)
+			{
+				d[x] = 0;
+				m[x] = 0.f;
+				s[x] = 0xFFFF;				// unknown
+				continue;
+			}
+			const float mean = _mean[row + x];
+			const float sigma = n > 1.f ? std::sqrt(_m2[row + x] / (n - 1.f)) : 0.f;
+			d[x] = (uint16_t)std::min(65535.f, mean + 0.5f);
+			m[x] = mean * units;
+			s[x] = (uint16_t)std::min(65535.f, sigma * 100.f + 0.5f);
+			valid++;
+			deviation_sum += sigma;
+		}
+	}
+
+	_result.depth = depth;
+	_result.meters = meters;
+	_result.deviation = deviation;
+	_result.samples = samples;
+	_result.frames = _added;
+	_result.min_valid = _min_valid;
+	_result.first_frame = _first_frame;
+	_result.last_frame = last.get_frame_number();
+	_result.skipped = _skipped - _skipped_base;
+	_result.fill = w && h ? (double)valid / ((double)w * h) : 0;
+	_result.mean_deviation = valid ? deviation_sum / valid : 0;
+}
+
+void depth_average::done(const depth_average_result& result)
+{
+	// ready for the next start() before the callback runs, which may start one itself
+	depth_average_result copy = result;
+	done_callback on_done = std::move(_on_done);
+	_on_done = nullptr;
+	_result = depth_average_result();		// drop the result frames, the callback holds its own
+	_added = 0;
+	_busy = false;
+	if (on_done) on_done(copy);
+}
+
+void capture_average(const depth_average_result& result, const std::chrono::seconds& timstp,
+	capture_writer& writer, const std::string& camera, std::vector<std::string>* queued)
+{
+	if (!result)
+	{
+		std::cout << "Average stopped before its last frame, nothing to capture" << std::endl;
+		return;
+	}
+	std::cout << "Average of " << result.frames << " frames #" << result.first_frame << " .. #" << result.last_frame;
+	if (!camera.empty()) std::cout << " (camera " << camera << ")";
+	std::cout << " : depth fill " << (int)(result.fill * 100) << "%, deviation " << result.mean_deviation << " units";
+	if (result.skipped) std::cout << ", " << result.skipped << " frames skipped";
+	std::cout << std::endl;
+
+	const std::string stream = result.depth.get_profile().stream_name();
+	std::stringstream prefix;
+	prefix << "output_image/" << timstp.count() << (camera.empty() ? std::string() : "_" + camera) << "_avg" << result.frames << "_";
+	const bool rvl = writer.depth_format() == capture_job::rvl_z16;
+
+	std::vector<capture_job> jobs;
+	jobs.push_back({ result.depth, prefix.str() + "depth-u16_" + stream + (rvl ? ".rvl" : ".png"), writer.depth_format() });
+	jobs.push_back({ result.meters, prefix.str() + "depth-f32_" + stream + ".tiff", capture_job::tiff_f32 });
+	jobs.push_back({ result.deviation, prefix.str() + "deviation-u16_" + stream + ".png", capture_job::png_z16 });
+	jobs.push_back({ result.samples, prefix.str() + "samples-u16_" + stream + ".png", capture_job::png_z16 });
+	jobs.push_back({ result.depth, prefix.str() + "metadata_" + stream + ".csv", capture_job::csv_metadata });	// of the last frame
+	for (auto& job : jobs)
+	{
+		std::string fname = job.filename;
+		if (!writer.submit(std::move(job)))
+			std::cout << "Capture queue full, dropped : " << fname << std::endl;
+		else if (queued)
+			queued->push_back(fname);
+	}
+}
@@ -0,0 +1,118 @@
+// depth_average.h : multi-frame depth average for low-noise captures
+//
+// One Z16 frame carries a few depth units of temporal noise, too much for
+// 0.1 mm work (Labv1_defaultBased_01mm_LightLowest.json). depth_average
+// accumulates the next N raw depth frames of a camera (before align and the
+// filters, on the depth sensor's pixel grid) into a running per-pixel mean and
+// variance (Welford) with the number of valid samples : 12 bytes a pixel, each
+// frame is released as soon as it has been added, never N frames at once.
+//
+// The feeding thread only hands the frame reference over (offer() never
+// blocks), the SSE2 accumulation runs on a thread of its own, so the preview
+// and the processing chain keep their rate. A frame offered while the queue is
+// full is skipped and counted; the average still takes N frames.
+//
+// Result frames, allocated from the averaging thread's own frame pool :
+//   depth      Z16 mean rounded to depth units, 0 with fewer than min_valid samples
+//   meters     float mean in meters (RS2_FORMAT_DISTANCE), keeps the sub-unit precision
+//   deviation  Z16 standard deviation of the samples in 1/100 depth units, saturated
+//   samples    Z16 number of valid (non-zero) samples
+// deviation and samples are the confidence map of the mean.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include "capture_writer.h"
+#include "latency_histogram.h"
+#include "spsc_queue.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct depth_average_result
+{
+	rs2::frame depth, meters, deviation, samples;
+	unsigned frames = 0;					// averaged, 0 = cancelled (stopped before N frames)
+	unsigned min_valid = 0;
+	unsigned long long first_frame = 0, last_frame = 0;
+	unsigned long long skipped = 0;			// offered while the queue was full, not averaged
+	double fill = 0;						// pixels with a mean / pixels
+	double mean_deviation = 0;				// depth units, over the pixels with a mean
+
+	explicit operator bool() const { return frames != 0; }
+};
+
+class depth_average
+{
+public:
+	enum kernel_type { kernel_scalar, kernel_sse2 };
+
+	// on the averaging thread, once the last frame is added (or with an empty result when stopped)
+	typedef std::function<void(const depth_average_result&)> done_callback;
+
+	explicit depth_average(size_t queue_frames = 4);	// starts the averaging thread
+	~depth_average() { stop(); }
+	depth_average(const depth_average&) = delete;
+	depth_average& operator=(const depth_average&) = delete;
+
+	// average the next frames depth frames offered; pixels with fewer than min_valid
+	// valid samples (0 = half of frames) get no mean. false while an average runs
+	bool start(unsigned frames, unsigned min_valid, done_callback on_done);
+	bool busy() const { return _busy; }
+	size_t queued() const { return _queue.size(); }	// handed over, not added yet
+	// offered frames held at most : the queue and the one being added; the pool they come
+	// from has to grow by that many or the stream runs short while an average runs
+	size_t pinned_frames() const { return _queue.capacity() + 1; }
+
+	// feeding thread : takes a reference to the Z16 frame while an average wants frames
+	void offer(const rs2::frame& depth);
+
+	void stop();							// cancels a running average, joins the thread
+
+	kernel_type kernel() const { return _kernel; }
+	void force_kernel(kernel_type k);		// benchmarks / tests, clamped to what the CPU supports
+	static const char* kernel_name(kernel_type k);
+
+	latency_histogram add_latency;			// per frame, averaging thread; read when idle
+
+private:
+	void worker();
+	void add(const rs2::video_frame& depth);
+	void finish(const rs2::video_frame& last, const rs2::frame_source& source);
+	void done(const depth_average_result& result);
+
+	spsc_queue<rs2::frame> _queue;
+	kernel_type _kernel, _best_kernel;
+
+	// set by start() before _wanted, read by the averaging thread after the first frame
+	unsigned _frames = 0, _min_valid = 0;
+	done_callback _on_done;
+	std::atomic<bool> _busy{ false };
+	std::atomic<unsigned> _wanted{ 0 };		// frames still to hand over, feeding thread
+	std::atomic<unsigned long long> _skipped{ 0 };
+	unsigned long long _skipped_base = 0;	// _skipped when the average started
+
+	// averaging thread state
+	int _width = 0, _height = 0;
+	unsigned _added = 0;
+	unsigned long long _first_frame = 0;
+	std::vector<float> _mean, _m2, _count;	// float count : the SSE2 kernel needs no conversion
+	depth_average_result _result;
+	rs2::stream_profile _meters_profile;	// RS2_FORMAT_DISTANCE clone of the depth profile
+	int _meters_profile_source = -1;
+
+	rs2::processing_block _finish_block;	// frame pool of the result frames
+	std::thread _thread;
+};
+
+// Queue the result files of one average ("_avg<N>_" in the name after the timestamp and
+// camera tag) : mean as writer.depth_format(), float meters as TIFF, deviation and samples
+// as 16 bit PNG; queued collects the names of the queued files
+void capture_average(const depth_average_result& result, const std::chrono::seconds& timstp,
+	capture_writer& writer, const std::string& camera = std::string(), std::vector<std::string>* queued = nullptr);
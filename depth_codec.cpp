@@ -0,0 +1,305 @@
+// depth_codec.cpp : lossless 16 bit depth compression (RVL)
+//
+
+#include "depth_codec.h"
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define RVL_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+static const char rvl_magic[4] = { 'R', 'V', 'L', '1' };
+
+#ifdef RVL_SSE2
+static inline unsigned lowest_bit(unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, mask);
+	return (unsigned)i;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+#endif
+
+// number of samples from p before the first non-zero one (before end)
+static inline size_t zero_run(const uint16_t* p, const uint16_t* end)
+{
+	const uint16_t* start = p;
+#ifdef RVL_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; end - p >= 8; p += 8)
+	{
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)p), zero));
+		if (mask != 0xFFFF) return (size_t)(p - start) + lowest_bit(~mask & 0xFFFF) / 2;
+	}
+#endif
+	while (p != end && !*p) p++;
+	return (size_t)(p - start);
+}
+
+// number of samples from p before the first zero one (before end)
+static inline size_t value_run(const uint16_t* p, const uint16_t* end)
+{
+	const uint16_t* start = p;
+#ifdef RVL_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; end - p >= 8; p += 8)
+	{
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)p), zero));
+		if (mask) return (size_t)(p - start) + lowest_bit(mask) / 2;
+	}
+#endif
+	while (p != end && *p) p++;
+	return (size_t)(p - start);
+}
+
+static inline uint32_t zigzag(int32_t delta)
+{
+	return ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+}
+
+namespace
+{
+	// RVL nibbles, most significant first in each 32 bit word
+	class nibble_writer
+	{
+	public:
+		explicit nibble_writer(uint8_t* out) : _out(out), _start(out) {}
+
+		void put(uint32_t value)
+		{
+			uint64_t code = 0;
+			int n = 0;
+			do
+			{
+				uint32_t nibble = value & 7;
+				value >>= 3;
+				if (value) nibble |= 8;
+				code = (code << 4) | nibble;
+				n++;
+			} while (value);
+			_acc = (_acc << (4 * n)) | code;	// at most 7 + 7 nibbles pending, fits
+			_pending += n;
+			if (_pending >= 8)
+			{
+				_pending -= 8;
+				store((uint32_t)(_acc >> (4 * _pending)));
+			}
+		}
+
+		size_t finish()
+		{
+			if (_pending) store((uint32_t)(_acc << (4 * (8 - _pending))));
+			_pending = 0;
+			return (size_t)(_out - _start);
+		}
+
+	private:
+		void store(uint32_t word)
+		{
+			memcpy(_out, &word, 4);				// native order, like the reference int* stream
+			_out += 4;
+		}
+
+		uint8_t* _out;
+		uint8_t* _start;
+		uint64_t _acc = 0;
+		int _pending = 0;
+	};
+
+	class nibble_reader
+	{
+	public:
+		nibble_reader(const uint8_t* in, size_t bytes) : _in(in), _end(in + (bytes & ~(size_t)3)) {}
+
+		// false when the stream ends inside a value or a value runs past 32 bits (corrupt)
+		bool get(uint32_t& value)
+		{
+			value = 0;
+			int shift = 0;
+			uint32_t nibble;
+			do
+			{
+				if (shift > 27) return false;		// checked per nibble, a word holds 8 of them
+				if (!_left)
+				{
+					if (_in == _end) return false;
+					memcpy(&_word, _in, 4);
+					_in += 4;
+					_left = 8;
+				}
+				nibble = _word >> 28;
+				_word <<= 4;
+				_left--;
+				value |= (nibble & 7) << shift;
+				shift += 3;
+			} while (nibble & 8);
+			return true;
+		}
+
+	private:
+		const uint8_t* _in;
+		const uint8_t* _end;
+		uint32_t _word = 0;
+		int _left = 0;
+	};
+}
+
+// larger than any depth stream (D400 : 1280 x 720), bounds what a corrupt header can allocate
+static const uint64_t rvl_max_pixels = 8192ull * 8192;
+
+size_t rvl_max_bytes(size_t pixels)
+{
+	// at most 6 nibbles per sample (17 bit zigzag delta) plus one pair of run lengths
+	return pixels * 3 + 16;
+}
+
+size_t rvl_encode(const uint16_t* depth, size_t pixels, uint8_t* out)
+{
+	nibble_writer writer(out);
+	const uint16_t* p = depth;
+	const uint16_t* end = depth + pixels;
+	int32_t previous = 0;
+	uint32_t deltas[8];
+
+	while (p != end)
+	{
+		size_t zeros = zero_run(p, end);
+		p += zeros;
+		writer.put((uint32_t)zeros);
+		size_t values = value_run(p, end);
+		writer.put((uint32_t)values);
+		if (!values) continue;
+
+		// first sample against the last one of the previous run, the rest against their neighbour
+		writer.put(zigzag((int32_t)*p - previous));
+		size_t i = 1;
+#ifdef RVL_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		for (; i + 8 <= values; i += 8)
+		{
+			__m128i cur = _mm_loadu_si128((const __m128i*)(p + i));
+			__m128i prev = _mm_loadu_si128((const __m128i*)(p + i - 1));
+			__m128i lo = _mm_sub_epi32(_mm_unpacklo_epi16(cur, zero), _mm_unpacklo_epi16(prev, zero));
+			__m128i hi = _mm_sub_epi32(_mm_unpackhi_epi16(cur, zero), _mm_unpackhi_epi16(prev, zero));
+			lo = _mm_xor_si128(_mm_slli_epi32(lo, 1), _mm_srai_epi32(lo, 31));
+			hi = _mm_xor_si128(_mm_slli_epi32(hi, 1), _mm_srai_epi32(hi, 31));
+			_mm_storeu_si128((__m128i*)deltas, lo);
+			_mm_storeu_si128((__m128i*)(deltas + 4), hi);
+			for (int k = 0; k < 8; k++) writer.put(deltas[k]);
+		}
+#endif
+		for (; i < values; i++) writer.put(zigzag((int32_t)p[i] - (int32_t)p[i - 1]));
+		previous = p[values - 1];
+		p += values;
+	}
+	return writer.finish();
+}
+
+bool rvl_decode(const uint8_t* in, size_t bytes, uint16_t* depth, size_t pixels)
+{
+	nibble_reader reader(in, bytes);
+	uint16_t* p = depth;
+	uint16_t* end = depth + pixels;
+	int64_t current = 0;					// a delta of a corrupt stream may take it anywhere
+
+	while (p != end)
+	{
+		uint32_t zeros, values;
+		if (!reader.get(zeros) || zeros > (size_t)(end - p)) return false;
+		memset(p, 0, zeros * sizeof(uint16_t));
+		p += zeros;
+		if (!reader.get(values) || values > (size_t)(end - p)) return false;
+		for (uint32_t i = 0; i < values; i++)
+		{
+			uint32_t z;
+			if (!reader.get(z)) return false;
+			current += (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+			if (current < 0 || current > 0xFFFF) return false;	// not a Z16 code : not written by rvl_encode
+			*p++ = (uint16_t)current;
+		}
+	}
+	return true;
+}
+
+bool rvl_write_file(const std::string& filename, const uint16_t* depth, int width, int height, int stride_bytes,
+	float depth_scale, uint64_t frame_number, double timestamp)
+{
+	if (width <= 0 || height <= 0) return false;
+	const size_t pixels = (size_t)width * height;
+
+	// scratch per encoder thread, sized by the first frame
+	thread_local std::vector<uint16_t> packed;
+	thread_local std::vector<uint8_t> buffer;
+	if (stride_bytes != width * 2)
+	{
+		packed.resize(pixels);
+		for (int y = 0; y < height; y++)
+			memcpy(&packed[(size_t)y * width], (const uint8_t*)depth + (size_t)y * stride_bytes, (size_t)width * 2);
+		depth = packed.data();
+	}
+	buffer.resize(sizeof(rvl_file_header) + rvl_max_bytes(pixels));
+
+	rvl_file_header h = {};
+	memcpy(h.magic, rvl_magic, sizeof(h.magic));
+	h.header_size = sizeof(rvl_file_header);
+	h.width = (uint32_t)width;
+	h.height = (uint32_t)height;
+	h.depth_scale = depth_scale;
+	h.payload_bytes = (uint32_t)rvl_encode(depth, pixels, buffer.data() + sizeof(h));
+	h.frame_number = frame_number;
+	h.timestamp = timestamp;
+	memcpy(buffer.data(), &h, sizeof(h));
+
+	FILE* f = nullptr;
+#ifdef _MSC_VER
+	if (fopen_s(&f, filename.c_str(), "wb")) f = nullptr;
+#else
+	f = fopen(filename.c_str(), "wb");
+#endif
+	if (!f) return false;
+	const size_t total = sizeof(h) + h.payload_bytes;
+	bool ok = fwrite(buffer.data(), 1, total, f) == total;
+	return fclose(f) == 0 && ok;
+}
+
+bool rvl_read_file(const std::string& filename, rvl_file_header& header, std::vector<uint16_t>& depth)
+{
+	FILE* f = nullptr;
+#ifdef _MSC_VER
+	if (fopen_s(&f, filename.c_str(), "rb")) f = nullptr;
+#else
+	f = fopen(filename.c_str(), "rb");
+#endif
+	if (!f) return false;
+
+	// sizes of a corrupt header are checked against the file before anything is allocated
+	long file_bytes = -1;
+	if (fseek(f, 0, SEEK_END) == 0) file_bytes = ftell(f);
+	std::vector<uint8_t> payload;
+	bool ok = file_bytes >= (long)sizeof(header) && fseek(f, 0, SEEK_SET) == 0 &&
+		fread(&header, sizeof(header), 1, f) == 1 &&
+		!memcmp(header.magic, rvl_magic, sizeof(rvl_magic)) &&
+		header.header_size >= sizeof(header) && header.header_size <= (uint64_t)file_bytes &&
+		header.payload_bytes <= (uint64_t)file_bytes - header.header_size &&
+		header.width && header.height && (uint64_t)header.width * header.height <= rvl_max_pixels &&
+		fseek(f, (long)header.header_size, SEEK_SET) == 0;
+	if (ok)
+	{
+		payload.resize(header.payload_bytes);
+		ok = fread(payload.data(), 1, payload.size(), f) == payload.size();
+	}
+	fclose(f);
+	if (!ok) return false;
+
+	depth.resize((size_t)header.width * header.height);
+	return rvl_decode(payload.data(), payload.size(), depth.data(), depth.size());
+}
@@ -0,0 +1,51 @@
+// depth_codec.h : lossless 16 bit depth compression (RVL)
+//
+// RVL (A. Wilson, "Fast Lossless Depth Image Compression", 2017) : the image
+// is a sequence of (zero run, non-zero run) pairs; the non-zero samples are
+// stored as zigzag deltas to the previous non-zero sample. Run lengths and
+// deltas are written as variable-length nibbles (3 data bits, 1 continue
+// bit, low bits first) packed most significant nibble first into 32 bit
+// words. A D400 frame is mostly smooth surfaces and holes, so most deltas
+// fit one nibble.
+//
+// The run scans and the delta / zigzag step are SSE2; the nibbles are built
+// per value and shifted into a 64 bit accumulator, one store per 8 nibbles.
+// The bitstream is the one of the reference implementation.
+//
+// .rvl file : rvl_file_header, then payload_bytes of RVL data.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#pragma pack(push, 1)
+struct rvl_file_header
+{
+	char magic[4];						// "RVL1"
+	uint32_t header_size;				// sizeof(rvl_file_header)
+	uint32_t width, height;
+	float depth_scale;					// meters per Z16 unit
+	uint32_t payload_bytes;
+	uint64_t frame_number;
+	double timestamp;					// ms, camera domain
+};
+#pragma pack(pop)
+
+// largest RVL payload for that many samples (alternating single zeros and values)
+size_t rvl_max_bytes(size_t pixels);
+
+// depth : pixels tightly packed samples, out : rvl_max_bytes(pixels) bytes; returns the payload size
+size_t rvl_encode(const uint16_t* depth, size_t pixels, uint8_t* out);
+
+// false on a truncated or corrupt payload, or one that does not describe exactly pixels samples
+bool rvl_decode(const uint8_t* in, size_t bytes, uint16_t* depth, size_t pixels);
+
+// one file per frame; depth may have a row stride (bytes) larger than width * 2
+bool rvl_write_file(const std::string& filename, const uint16_t* depth, int width, int height, int stride_bytes,
+	float depth_scale, uint64_t frame_number = 0, double timestamp = 0);
+
+// depth is resized to width * height; false on a missing, truncated or corrupt file
+bool rvl_read_file(const std::string& filename, rvl_file_header& header, std::vector<uint16_t>& depth);
@@ -0,0 +1,108 @@
+// depth_convert.cpp : .rvl <-> 16 bit PNG depth converter
+//
+//   depth_convert [--scale METERS] <file>...
+//
+// Every .rvl file is written next to itself as a 16 bit grayscale PNG (the
+// format capture_light1 used before .rvl), every .png as .rvl. A PNG has no
+// depth scale, --scale sets the one stored in the .rvl header (default 0.001).
+// The samples are compared after each conversion, a mismatch fails the run.
+
+#include "depth_codec.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static bool ends_with(const std::string& s, const std::string& suffix)
+{
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static std::string replace_extension(const std::string& file, const std::string& ext)
+{
+	return file.substr(0, file.find_last_of('.')) + ext;
+}
+
+static bool rvl_to_png(const std::string& in)
+{
+	rvl_file_header h;
+	std::vector<uint16_t> depth;
+	if (!rvl_read_file(in, h, depth))
+	{
+		std::cerr << "cannot read " << in << std::endl;
+		return false;
+	}
+	std::string out = replace_extension(in, ".png");
+	cv::Mat depth16((int)h.height, (int)h.width, CV_16UC1, depth.data());
+	if (!cv::imwrite(out, depth16))
+	{
+		std::cerr << "cannot write " << out << std::endl;
+		return false;
+	}
+	cv::Mat check = cv::imread(out, cv::IMREAD_ANYDEPTH);
+	if (check.type() != CV_16UC1 || cv::countNonZero(check != depth16))
+	{
+		std::cerr << out << " differs from " << in << std::endl;
+		return false;
+	}
+	std::cout << in << " -> " << out << " (" << h.width << "x" << h.height << ", frame " << h.frame_number << ")" << std::endl;
+	return true;
+}
+
+static bool png_to_rvl(const std::string& in, float depth_scale)
+{
+	cv::Mat depth16 = cv::imread(in, cv::IMREAD_ANYDEPTH);
+	if (depth16.empty() || depth16.type() != CV_16UC1)
+	{
+		std::cerr << in << " is not a 16 bit grayscale PNG" << std::endl;
+		return false;
+	}
+	std::string out = replace_extension(in, ".rvl");
+	if (!rvl_write_file(out, (const uint16_t*)depth16.data, depth16.cols, depth16.rows, (int)depth16.step, depth_scale))
+	{
+		std::cerr << "cannot write " << out << std::endl;
+		return false;
+	}
+	rvl_file_header h;
+	std::vector<uint16_t> check;
+	if (!rvl_read_file(out, h, check) || cv::countNonZero(cv::Mat(depth16.rows, depth16.cols, CV_16UC1, check.data()) != depth16))
+	{
+		std::cerr << out << " differs from " << in << std::endl;
+		return false;
+	}
+	std::cout << in << " -> " << out << " (" << (double)depth16.total() * 2 / h.payload_bytes << " : 1)" << std::endl;
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	float depth_scale = 0.001f;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		if (arg == "--scale" && i + 1 < argc) depth_scale = (float)atof(argv[++i]);
+		else files.push_back(arg);
+	}
+	if (files.empty())
+	{
+		std::cerr << "usage : depth_convert [--scale METERS] <file.rvl | file.png>..." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	bool ok = true;
+	for (auto& file : files)
+	{
+		if (ends_with(file, ".rvl")) ok = rvl_to_png(file) && ok;
+		else if (ends_with(file, ".png")) ok = png_to_rvl(file, depth_scale) && ok;
+		else
+		{
+			std::cerr << "unknown extension : " << file << std::endl;
+			ok = false;
+		}
+	}
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
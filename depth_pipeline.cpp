@@ -0,0 +1,288 @@
+// depth_pipeline.cpp : align / filter / colorize chain
+//
+
+#include "depth_pipeline.h"
+#include "thread_affinity.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+static uint64_t elapsed_us(std::chrono::steady_clock::time_point since)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now() - since).count();
+}
+
+depth_pipeline::depth_pipeline(float min_z, float max_z)
+	: _lut(min_z, max_z),
+	depth2disparity(true),
+	disparity2depth(false),
+	align_to(RS2_STREAM_COLOR),
+	_filter_block([this](rs2::frameset data, rs2::frame_source& source) { filter(data, source); }),
+	_colorize_block([this](rs2::frameset data, rs2::frame_source& source) { colorize(data, source); })
+{
+	// colorizer config
+	color_map.set_option(RS2_OPTION_COLOR_SCHEME, 2); //White to black from near to far
+	color_map.set_option(RS2_OPTION_HISTOGRAM_EQUALIZATION_ENABLED, 0);
+	color_map.set_option(RS2_OPTION_MIN_DISTANCE, min_z); // minZ
+	color_map.set_option(RS2_OPTION_MAX_DISTANCE, max_z); // maxZ
+
+	dec.set_option(RS2_OPTION_FILTER_MAGNITUDE, 2);
+	spat.set_option(RS2_OPTION_HOLES_FILL, 2);	// Enable hole-filling, 5 = fill all the zero pixels
+	sync_spatial_options();
+}
+
+void depth_pipeline::set_holes_fill(int mode)
+{
+	spat.set_option(RS2_OPTION_HOLES_FILL, (float)mode);
+	sync_spatial_options();
+}
+
+void depth_pipeline::set_cores(const std::vector<unsigned>& cores)
+{
+	_cores = cores;
+	if (!cores.empty()) _spatial.set_threads((unsigned)cores.size(), cores);
+}
+
+size_t depth_pipeline::reserve_frames(size_t extra)
+{
+	rs2::options* blocks[] = { &color_map, &depth2disparity, &disparity2depth, &spat, &temp, &align_to,
+		&_filter_block, &_colorize_block };
+	size_t granted = extra;
+	for (auto block : blocks)
+	{
+		if (!block->supports(RS2_OPTION_FRAMES_QUEUE_SIZE)) continue;
+		auto range = block->get_option_range(RS2_OPTION_FRAMES_QUEUE_SIZE);
+		float size = block->get_option(RS2_OPTION_FRAMES_QUEUE_SIZE);
+		float grown = std::min(size + (float)extra, range.max);
+		block->set_option(RS2_OPTION_FRAMES_QUEUE_SIZE, grown);
+		granted = std::min(granted, (size_t)std::max(0.f, grown - size));
+	}
+	return granted;
+}
+
+// tiled_spatial_filter takes its settings from spat, so both always run the same filter
+void depth_pipeline::sync_spatial_options()
+{
+	_spatial.set_options(spat.get_option(RS2_OPTION_FILTER_SMOOTH_ALPHA),
+		spat.get_option(RS2_OPTION_FILTER_SMOOTH_DELTA),
+		(int)spat.get_option(RS2_OPTION_FILTER_MAGNITUDE),
+		(int)spat.get_option(RS2_OPTION_HOLES_FILL));
+}
+
+rs2::frame depth_pipeline::spatial_stage(const rs2::frame& disparity, rs2::frame_source& source)
+{
+	if (!_use_tiled_spatial) return spat.process(disparity);
+
+	auto t0 = std::chrono::steady_clock::now();
+	rs2::frame filtered = _spatial.process(disparity, source);
+	if (!filtered)
+	{
+		std::cout << "tiled spatial filter needs 32 bit disparity, using rs2::spatial_filter" << std::endl;
+		_use_tiled_spatial = false;
+		return spat.process(disparity);
+	}
+	if (_timing) spatial_latency.record_us(elapsed_us(t0));
+
+	if (_verify_spatial_frames)
+	{
+		if (_verify_spatial_frames > 0) _verify_spatial_frames--;
+		auto t1 = std::chrono::steady_clock::now();
+		auto reference = spat.process(disparity);
+		if (_timing) spatial_reference_latency.record_us(elapsed_us(t1));
+		long long diff = tiled_spatial_filter::compare(filtered, reference);
+		if (diff && _spatial.mode() == tiled_spatial_filter::mode_exact)
+		{
+			std::cout << "tiled spatial filter differs from rs2::spatial_filter on " << diff
+				<< " pixels, using rs2::spatial_filter" << std::endl;
+			_use_tiled_spatial = false;
+			filtered = reference;
+		}
+		_spatial_mismatches += diff > 0 ? diff : diff < 0 ? 1 : 0;	// -1 : size or format differs
+	}
+	return filtered;
+}
+
+// depth frame number of a frameset (or of a single frame)
+static unsigned long long frame_number(const rs2::frame& f)
+{
+	if (auto fs = f.as<rs2::frameset>())
+		if (auto depth = fs.get_depth_frame()) return depth.get_frame_number();
+	return f.get_frame_number();
+}
+
+void depth_pipeline::start(std::function<void(rs2::frameset)> on_frames)
+{
+	_on_frames = on_frames;
+
+	// both blocks deliver synchronously, on the thread that invoked them
+	_filter_block.start([this](rs2::frame f) {
+		stage_item item{ f, _filter_arrived };
+		if (!pipelined()) colorize_stage(item);
+		else
+		{
+			colorize_queue.push();
+			_colorize_q->push(std::move(item));
+		}
+	});
+	_colorize_block.start([this](rs2::frame f) {
+		if (_timing) total_latency.record_us(elapsed_us(_colorize_arrived));
+		_on_frames(f);
+	});
+
+	if (!pipelined()) return;
+	_align_q.reset(new spsc_queue<stage_item>(_queue_size));
+	_filter_q.reset(new spsc_queue<stage_item>(_queue_size));
+	_colorize_q.reset(new spsc_queue<stage_item>(_queue_size));
+	_stage_threads.emplace_back([this]() {
+		pin_current_thread(_cores);
+		stage_loop(*_align_q, align_queue, _filter_q.get(), [this](stage_item& item) {
+			align_stage(item);
+			filter_queue.push();
+			_filter_q->push(std::move(item));
+		});
+	});
+	_stage_threads.emplace_back([this]() {
+		pin_current_thread(_cores);
+		stage_loop(*_filter_q, filter_queue, _colorize_q.get(), [this](stage_item& item) { filter_stage(item); });
+	});
+	_stage_threads.emplace_back([this]() {
+		pin_current_thread(_cores);
+		stage_loop(*_colorize_q, colorize_queue, nullptr, [this](stage_item& item) { colorize_stage(item); });
+	});
+}
+
+void depth_pipeline::invoke(const rs2::frameset& fs)
+{
+	stage_item item{ fs, std::chrono::steady_clock::now() };
+	if (!pipelined())
+	{
+		align_stage(item);
+		filter_stage(item);
+		return;
+	}
+	align_queue.push();
+	_align_q->push(std::move(item));
+}
+
+void depth_pipeline::stop()
+{
+	if (_stage_threads.empty()) return;
+	_align_q->close();						// each stage drains its queue, then closes the next one
+	for (auto& t : _stage_threads) t.join();
+	_stage_threads.clear();
+}
+
+// one stage thread : take frames in order until the input is closed and empty
+void depth_pipeline::stage_loop(spsc_queue<stage_item>& in, stage_stats& stats, spsc_queue<stage_item>* out,
+	std::function<void(stage_item&)> work)
+{
+	stage_item item;
+	while (in.pop(item))
+	{
+		stats.pop_lossless(frame_number(item.frame));
+		work(item);
+		item = stage_item();				// release the frames before waiting for the next one
+	}
+	if (out) out->close();
+}
+
+void depth_pipeline::print_stages(std::ostream& os) const
+{
+	align_queue.print(os);
+	filter_queue.print(os);
+	colorize_queue.print(os);
+}
+
+void depth_pipeline::align_stage(stage_item& item)
+{
+	auto t0 = std::chrono::steady_clock::now();
+	item.frame = align_to.process(item.frame);	//make the frames spatially aligned
+	if (_timing) align_latency.record_us(elapsed_us(t0));
+}
+
+void depth_pipeline::filter_stage(const stage_item& item)
+{
+	_filter_arrived = item.arrived;
+	_filter_block.invoke(item.frame);
+}
+
+void depth_pipeline::colorize_stage(const stage_item& item)
+{
+	_colorize_arrived = item.arrived;
+	_colorize_block.invoke(item.frame);
+}
+
+void depth_pipeline::filter(rs2::frameset data, rs2::frame_source& source)
+{
+	// data: aligned frameset
+	// source: Frame pool that can allocate new frames
+	// filter chain runs exactly once per frameset, temp filter sees every frame once and in order
+	auto t1 = std::chrono::steady_clock::now();
+
+	rs2::depth_frame aligned = data.get_depth_frame();
+	rs2::depth_frame depth = aligned;			// Apply depth post-processing
+	if (_roi.active()) depth = _roi.crop(aligned, source);	// filters only see the work area / band
+
+	//depth = dec.process(depth);			// Decimation Filter (reducing resolution)
+	depth = depth2disparity.process(depth);	// switch to disparity domain
+	depth = spatial_stage(depth, source);	// Apply spatial filtering
+	depth = temp.process(depth);			// Apply temporal filtering
+	depth = disparity2depth.process(depth);	// If in disparity domain, switch depth
+	if (_roi.active()) depth = _roi.embed(depth, aligned, source);	// back to full size for colorizer / capture
+	if (_timing) filter_latency.record_us(elapsed_us(t1));
+
+	source.frame_ready(source.allocate_composite_frame({ depth, data.get_color_frame() }));
+}
+
+void depth_pipeline::colorize(rs2::frameset data, rs2::frame_source& source)
+{
+	// data: filtered depth + aligned colour
+	auto t2 = std::chrono::steady_clock::now();
+	rs2::depth_frame depth = data.get_depth_frame();
+
+	// Apply color map for visualization of depth
+	rs2::frame colorized;
+	if (_use_lut)
+	{
+		colorized = _lut.process(depth, source);
+		if (_verify_frames)
+		{
+			if (_verify_frames > 0) _verify_frames--;
+			auto reference = color_map.process(depth);
+			long long diff = lut_colorizer::compare(colorized, reference);
+			if (diff)
+			{
+				std::cout << "LUT colorizer differs from rs2::colorizer on " << diff
+					<< " pixels, using rs2::colorizer" << std::endl;
+				_mismatches += diff > 0 ? diff : 1;	// -1 : size or format differs
+				_use_lut = false;
+				colorized = reference;
+			}
+		}
+	}
+	else
+	{
+		colorized = color_map.process(depth);
+	}
+	auto color = data.get_color_frame();
+	if (_timing) colorize_latency.record_us(elapsed_us(t2));
+
+	// Group colorized(RGB8), color and filtered depth(Z16) together, so render and capture
+	// always see frames from the same frameset
+	rs2::frameset combined = source.allocate_composite_frame({ colorized, color, depth });
+
+	source.frame_ready(combined);			// Send the composite frame for rendering and capture
+}
+
+frame_snapshot depth_pipeline::snapshot(const rs2::frameset& combined)
+{
+	frame_snapshot snap;
+	snap.colorized = combined.first(RS2_STREAM_DEPTH, RS2_FORMAT_RGB8);
+	snap.color = combined.get_color_frame();
+	snap.depth = combined.first(RS2_STREAM_DEPTH, RS2_FORMAT_Z16);
+	snap.frame_number = snap.depth.get_frame_number();
+	snap.timestamp = snap.depth.get_timestamp();
+	return snap;
+}
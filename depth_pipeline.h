@@ -0,0 +1,153 @@
+// depth_pipeline.h : align / filter / colorize chain, run once per frameset
+//
+// Shared by the viewer (ConsoleApplication2.cpp) and the headless replay
+// harness (replay_bench.cpp) so both measure and run exactly the same
+// processing. The result of every frameset is one composite of
+// { colorized depth (RGB8), aligned colour (RGB8), filtered depth (Z16) }.
+//
+// The chain is three stages : align, filter (roi / disparity / spatial /
+// temporal), colorize. By default they run one after the other on the
+// invoking thread. With set_pipelined() each stage gets its own thread and
+// the stages are connected by bounded SPSC queues, so frame N is colorized
+// while N+1 is filtered and N+2 aligned : throughput is set by the slowest
+// stage instead of the sum. Every stage is one thread reading one FIFO, so
+// frames keep their order (the temporal filter sees them in sequence).
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "frame_snapshot.h"
+#include "frame_stats.h"
+#include "spsc_queue.h"
+#include "depth_roi.h"
+#include "latency_histogram.h"
+#include "lut_colorizer.h"
+#include "tiled_spatial_filter.h"
+
+class depth_pipeline
+{
+public:
+	// min_z / max_z : colorizer range in meters
+	depth_pipeline(float min_z, float max_z);
+	~depth_pipeline() { stop(); }
+
+	// queue_size > 0 : one thread per stage, bounded queues of that many framesets
+	// between them; call before start()
+	void set_pipelined(size_t queue_size) { _queue_size = queue_size; }
+	bool pipelined() const { return _queue_size > 0; }
+
+	// stage threads and the spatial filter pool run on these cores (one pool thread per
+	// core), empty = not pinned; call before start(), the invoking thread pins itself
+	void set_cores(const std::vector<unsigned>& cores);
+	const std::vector<unsigned>& cores() const { return _cores; }
+
+	// on_frames : called with the composite frameset, on the invoking thread or,
+	// pipelined, on the colorize thread
+	void start(std::function<void(rs2::frameset)> on_frames);
+
+	// pipelined : queues the frameset, blocks while the align queue is full
+	void invoke(const rs2::frameset& fs);
+
+	// pipelined : lets the queued frames through and joins the stage threads
+	void stop();
+
+	// per-stage latency (on each stage's thread), recorded only while timing is on
+	void enable_timing(bool on) { _timing = on; }
+	latency_histogram align_latency;
+	latency_histogram filter_latency;		// disparity -> spatial -> temporal -> depth
+	latency_histogram colorize_latency;
+	latency_histogram total_latency;		// invoke() to on_frames, queue waits included
+
+	// queue occupancy and frame order in front of each stage (pipelined)
+	stage_stats align_queue{ "align queue" };
+	stage_stats filter_queue{ "filter queue" };
+	stage_stats colorize_queue{ "colorize queue" };
+	void print_stages(std::ostream& os) const;
+	latency_histogram spatial_latency;			// spatial filter alone, part of filter_latency
+	latency_histogram spatial_reference_latency;	// rs2::spatial_filter while verifying
+
+	// colorizer : LUT kernel by default, checked against rs2::colorizer on the first
+	// verify frames (-1 = every frame), permanent fallback to rs2::colorizer on a mismatch
+	void use_lut_colorizer(bool on) { _use_lut = on; }
+	void verify_colorizer(int frames) { _verify_frames = frames; }
+	bool lut_colorizer_active() const { return _use_lut; }
+	lut_colorizer& lut() { return _lut; }
+	long long colorizer_mismatches() const { return _mismatches; }
+
+	// spatial filter : tiled_spatial_filter on all cores by default, checked against
+	// rs2::spatial_filter on the first verify frames (-1 = every frame); in mode_exact a
+	// difference falls back to rs2::spatial_filter for good, in mode_tiled it is only counted
+	void use_tiled_spatial(bool on) { _use_tiled_spatial = on; }
+	void verify_spatial(int frames) { _verify_spatial_frames = frames; }
+	bool tiled_spatial_active() const { return _use_tiled_spatial; }
+	tiled_spatial_filter& spatial() { return _spatial; }
+	long long spatial_mismatches() const { return _spatial_mismatches; }
+
+	// frames held outside the chain (pre-trigger ring) : every block whose output a
+	// snapshot can pin gets that many more frames in its pool, call before start().
+	// Pools are capped (RS2_OPTION_FRAMES_QUEUE_SIZE range) : returns the frames actually
+	// added to the smallest grown pool, a ring must not hold more than that
+	size_t reserve_frames(size_t extra);
+
+	// work area / depth band : the filters only see the ROI, set before start()
+	depth_roi& roi() { return _roi; }
+	void set_holes_fill(int mode);				// RS2_OPTION_HOLES_FILL of the spatial filter
+
+	// split a composite from start() into its three frames
+	static frame_snapshot snapshot(const rs2::frameset& combined);
+
+private:
+	// a frameset on its way through the stages, with the time invoke() got it
+	struct stage_item
+	{
+		rs2::frame frame;
+		std::chrono::steady_clock::time_point arrived;
+	};
+
+	void align_stage(stage_item& item);
+	void filter_stage(const stage_item& item);		// invokes _filter_block
+	void colorize_stage(const stage_item& item);	// invokes _colorize_block
+	void filter(rs2::frameset data, rs2::frame_source& source);
+	void colorize(rs2::frameset data, rs2::frame_source& source);
+	void stage_loop(spsc_queue<stage_item>& in, stage_stats& stats, spsc_queue<stage_item>* out,
+		std::function<void(stage_item&)> work);
+	rs2::frame spatial_stage(const rs2::frame& disparity, rs2::frame_source& source);
+	void sync_spatial_options();
+
+	rs2::colorizer color_map;					// Depth colorizer for visualize depth data (reference)
+	lut_colorizer _lut;							// same mapping, precomputed table
+	depth_roi _roi;								// crop / mask ahead of the filters
+	rs2::decimation_filter dec;					// Decimation filter reduces the amount of data
+	rs2::disparity_transform depth2disparity;	// Define transformations from and to Disparity domain
+	rs2::disparity_transform disparity2depth;
+	rs2::spatial_filter spat;					// Define spatial filter (edge-preserving) (reference)
+	tiled_spatial_filter _spatial;				// same filter, multi-threaded
+	rs2::temporal_filter temp;					// Define temporal filter
+	rs2::align align_to;						// Spatially align all streams to depth viewport
+
+	std::function<void(rs2::frameset)> _on_frames;
+	size_t _queue_size = 0;
+	std::vector<unsigned> _cores;
+	std::unique_ptr<spsc_queue<stage_item>> _align_q, _filter_q, _colorize_q;
+	std::vector<std::thread> _stage_threads;
+	std::chrono::steady_clock::time_point _filter_arrived, _colorize_arrived;	// item inside each block
+
+	std::atomic<bool> _timing{ false };
+	bool _use_lut = true;
+	int _verify_frames = 30;
+	long long _mismatches = 0;
+	bool _use_tiled_spatial = true;
+	int _verify_spatial_frames = 30;
+	long long _spatial_mismatches = 0;
+	rs2::processing_block _filter_block;		// declared last, their lambdas use the filters above
+	rs2::processing_block _colorize_block;
+};
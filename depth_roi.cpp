@@ -0,0 +1,150 @@
+// depth_roi.cpp : crop / depth-band mask ahead of the depth filters
+//
+
+#include "depth_roi.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+void depth_roi::set_rect(int x, int y, int width, int height)
+{
+	_x = std::max(0, x);
+	_y = std::max(0, y);
+	_width = std::max(0, width);
+	_height = std::max(0, height);
+}
+
+void depth_roi::set_band(float min_m, float max_m)
+{
+	_min_m = min_m;
+	_max_m = max_m;
+}
+
+void depth_roi::_clamp(int frame_width, int frame_height, int& x, int& y, int& w, int& h) const
+{
+	if (!_cropping())
+	{
+		x = y = 0;
+		w = frame_width;
+		h = frame_height;
+		return;
+	}
+	x = std::min(_x, frame_width - 1);
+	y = std::min(_y, frame_height - 1);
+	w = std::min(_width, frame_width - x);
+	h = std::min(_height, frame_height - y);
+}
+
+// a band limit in depth codes; a limit within 1/1000 of a code is that code : 0.2 m at 0.0001 units
+// is 2000.0001 in float (and in double, 0.0001f is not 0.0001), which ceil would make 2001
+static double band_code(float meters, float units)
+{
+	const double code = (double)meters / units;
+	const double nearest = std::round(code);
+	return std::fabs(code - nearest) < 1e-3 ? nearest : code;
+}
+
+// copy one row, zeroing codes outside [lo, hi]; plain loops, vectorised by the compiler
+static void copy_band(const uint16_t* src, uint16_t* dst, int width, uint16_t lo, uint16_t hi)
+{
+	for (int x = 0; x < width; x++)
+	{
+		uint16_t v = src[x];
+		dst[x] = (v >= lo && v <= hi) ? v : 0;
+	}
+}
+
+// filtered row back, zeroing what was masked out (raw value present but outside [lo, hi]) :
+// hole filling may have spread the band into it; real holes (raw 0) keep the filled value
+static void copy_unmasked(const uint16_t* filtered, const uint16_t* raw, uint16_t* dst, int width,
+	uint16_t lo, uint16_t hi)
+{
+	for (int x = 0; x < width; x++)
+	{
+		uint16_t r = raw[x];
+		dst[x] = (r != 0 && (r < lo || r > hi)) ? 0 : filtered[x];
+	}
+}
+
+rs2::frame depth_roi::crop(const rs2::depth_frame& depth, const rs2::frame_source& source)
+{
+	const int fw = depth.get_width(), fh = depth.get_height();
+	int x, y, w, h;
+	_clamp(fw, fh, x, y, w, h);
+
+	auto profile = depth.get_profile();
+	if (profile.unique_id() != _crop_profile_source || x != _crop_x || y != _crop_y || w != _crop_w || h != _crop_h)
+	{
+		// same stream, smaller image : shift the principal point so the filters and
+		// anything reading intrinsics downstream still see correct geometry
+		auto vsp = profile.as<rs2::video_stream_profile>();
+		rs2_intrinsics intr = vsp.get_intrinsics();
+		intr.width = w;
+		intr.height = h;
+		intr.ppx -= (float)x;
+		intr.ppy -= (float)y;
+		_crop_profile = vsp.clone(profile.stream_type(), profile.stream_index(), profile.format(), w, h, intr);
+		_crop_profile_source = profile.unique_id();
+		_crop_x = x; _crop_y = y; _crop_w = w; _crop_h = h;
+	}
+
+	// band in Z16 codes of this frame
+	_lo = 0;
+	_hi = 0xFFFF;
+	if (_band())
+	{
+		const float units = depth.get_units();
+		// codes inside the band only : [ceil(min), floor(max)], 0 stays "no depth"
+		_lo = (uint16_t)std::min(65535., std::max(1., std::ceil(band_code(_min_m, units))));
+		_hi = (uint16_t)std::min(65535., std::max(0., std::floor(band_code(_max_m, units))));
+	}
+
+	auto out = source.allocate_video_frame(_crop_profile, depth, 2, w, h, w * 2, RS2_EXTENSION_DEPTH_FRAME)
+		.as<rs2::video_frame>();
+	const int src_stride = depth.get_stride_in_bytes(), dst_stride = out.get_stride_in_bytes();
+	auto src = (const uint8_t*)depth.get_data() + (size_t)y * src_stride + (size_t)x * 2;
+	auto dst = (uint8_t*)out.get_data();
+	for (int row = 0; row < h; row++)
+	{
+		auto s = (const uint16_t*)(src + (size_t)row * src_stride);
+		auto d = (uint16_t*)(dst + (size_t)row * dst_stride);
+		if (_band()) copy_band(s, d, w, _lo, _hi);
+		else memcpy(d, s, (size_t)w * 2);
+	}
+	return out;
+}
+
+rs2::frame depth_roi::embed(const rs2::depth_frame& filtered, const rs2::depth_frame& full,
+	const rs2::frame_source& source)
+{
+	const int fw = full.get_width(), fh = full.get_height();
+	int x, y, w, h;
+	_clamp(fw, fh, x, y, w, h);
+	if (!active()) return filtered;
+
+	// copy the filters' metadata / timestamps, not the raw frame's
+	auto out = source.allocate_video_frame(full.get_profile(), filtered, 2, fw, fh, fw * 2, RS2_EXTENSION_DEPTH_FRAME)
+		.as<rs2::video_frame>();
+	const int dst_stride = out.get_stride_in_bytes(), src_stride = filtered.get_stride_in_bytes();
+	auto dst = (uint8_t*)out.get_data();
+	auto src = (const uint8_t*)filtered.get_data();
+	const int raw_stride = full.get_stride_in_bytes();
+	auto raw = (const uint8_t*)full.get_data() + (size_t)y * raw_stride + (size_t)x * 2;
+	w = std::min(w, filtered.get_width());
+	h = std::min(h, filtered.get_height());
+
+	memset(dst, 0, (size_t)y * dst_stride);
+	for (int row = 0; row < h; row++)
+	{
+		auto d = dst + (size_t)(y + row) * dst_stride;
+		auto s = src + (size_t)row * src_stride;
+		memset(d, 0, (size_t)x * 2);
+		if (_band()) copy_unmasked((const uint16_t*)s, (const uint16_t*)(raw + (size_t)row * raw_stride),
+			(uint16_t*)(d + (size_t)x * 2), w, _lo, _hi);
+		else memcpy(d + (size_t)x * 2, s, (size_t)w * 2);
+		memset(d + (size_t)(x + w) * 2, 0, (size_t)(fw - x - w) * 2);
+	}
+	memset(dst + (size_t)(y + h) * dst_stride, 0, (size_t)(fh - y - h) * dst_stride);
+	return out;
+}
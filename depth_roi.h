@@ -0,0 +1,51 @@
+// depth_roi.h : crop / depth-band mask ahead of the depth filters
+//
+// Only a fixed work area of the frame and the cz_minZ..cz_maxZ band matter,
+// but the spatial and temporal filters cost per pixel of the frame they get.
+// crop() copies the ROI of the aligned depth frame into a smaller Z16 frame
+// (intrinsics shifted to match) and zeroes samples outside the depth band;
+// the filters then run on that frame only. embed() puts the filtered ROI
+// back into a full-size frame for colorizing and capture : samples outside
+// the ROI or the band are 0 (no depth), as if the camera had not seen them.
+// Hole filling may spread the band into masked samples, embed() masks them
+// again; real holes (raw 0) keep their filled value.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <cstdint>
+
+class depth_roi
+{
+public:
+	// rectangle in pixels of the aligned depth frame, width / height 0 = whole frame;
+	// clamped to the frame every time it is applied
+	void set_rect(int x, int y, int width, int height);
+
+	// keep min_m..max_m (meters), min_m >= max_m = no band
+	void set_band(float min_m, float max_m);
+
+	// true if crop() / embed() change anything
+	bool active() const { return _cropping() || _band(); }
+
+	// ROI of depth as its own frame, band applied
+	rs2::frame crop(const rs2::depth_frame& depth, const rs2::frame_source& source);
+
+	// filtered : output of the filters for a frame from crop(), full : the frame given to crop()
+	rs2::frame embed(const rs2::depth_frame& filtered, const rs2::depth_frame& full,
+		const rs2::frame_source& source);
+
+private:
+	bool _cropping() const { return _width > 0 && _height > 0; }
+	bool _band() const { return _min_m < _max_m; }
+	void _clamp(int frame_width, int frame_height, int& x, int& y, int& w, int& h) const;
+
+	int _x = 0, _y = 0, _width = 0, _height = 0;
+	float _min_m = 0, _max_m = 0;
+	uint16_t _lo = 0, _hi = 0xFFFF;			// band in Z16 codes of the last crop()
+
+	rs2::stream_profile _crop_profile;		// ROI-sized clone of the last depth profile
+	int _crop_profile_source = -1;			// unique id of that depth profile
+	int _crop_x = -1, _crop_y = -1, _crop_w = 0, _crop_h = 0;	// rectangle it was made for
+};
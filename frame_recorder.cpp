@@ -0,0 +1,415 @@
+// frame_recorder.cpp : chunked recorder and memory-mapped reader
+//
+
+#include "frame_recorder.h"
+#include "depth_codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char rec_magic[8] = { 'R', 'S', 'R', 'E', 'C', '0', '0', '1' };
+static const char rec_index_magic[8] = { 'R', 'S', 'R', 'E', 'C', 'I', 'D', 'X' };
+
+static FILE* open_for_write(const std::string& name)
+{
+	FILE* f = nullptr;
+#ifdef _MSC_VER
+	if (fopen_s(&f, name.c_str(), "wb")) return nullptr;
+#else
+	f = fopen(name.c_str(), "wb");
+#endif
+	if (f) setvbuf(f, nullptr, _IONBF, 0);		// chunks are already large, skip the stdio copy
+	return f;
+}
+
+static int32_t metadata_or(const rs2::frame& f, rs2_frame_metadata_value v)
+{
+	return f.supports_frame_metadata(v) ? (int32_t)f.get_frame_metadata(v) : -1;
+}
+
+// copy a video frame into a tightly packed buffer, row by row when the stride has padding
+static void copy_packed(const rs2::video_frame& vf, uint8_t* dst)
+{
+	const size_t row = (size_t)vf.get_width() * vf.get_bytes_per_pixel();
+	const size_t stride = (size_t)vf.get_stride_in_bytes();
+	auto src = (const uint8_t*)vf.get_data();
+	if (row == stride)
+	{
+		memcpy(dst, src, row * vf.get_height());
+		return;
+	}
+	for (int y = 0; y < vf.get_height(); y++)
+		memcpy(dst + y * row, src + y * stride, row);
+}
+
+frame_recorder::frame_recorder(const recorder_config& cfg)
+	: _cfg(cfg), _ring(cfg.queue_size ? cfg.queue_size : 1), _chunk(cfg.chunk_bytes)
+{
+	_index.reserve(108000);				// one hour at 30 fps before the vector has to grow
+	_thread = std::thread([this]() { writer(); });
+}
+
+frame_recorder::~frame_recorder()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_cv.notify_one();
+	_thread.join();
+}
+
+bool frame_recorder::push(const frame_snapshot& snap)
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_stopping || _count == _ring.size())
+		{
+			_dropped++;
+			return false;
+		}
+		_ring[(_head + _count) % _ring.size()] = snap;	// slot reused, no allocation
+		_count++;
+	}
+	_cv.notify_one();
+	return true;
+}
+
+std::string frame_recorder::current_file() const
+{
+	std::lock_guard<std::mutex> lock(_name_mutex);
+	return _file_name;
+}
+
+void frame_recorder::writer()
+{
+	while (true)
+	{
+		frame_snapshot snap;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_cv.wait(lock, [this]() { return _stopping || _count; });
+			if (!_count) break;			// stopping and drained
+			std::swap(snap, _ring[_head]);	// leaves the slot empty, frames released by snap
+			_head = (_head + 1) % _ring.size();
+			_count--;
+		}
+		append(snap);
+	}
+	close_file();
+}
+
+void frame_recorder::append(const frame_snapshot& snap)
+{
+	auto depth = snap.depth.as<rs2::video_frame>();
+	auto color = snap.color.as<rs2::video_frame>();
+	if (!depth || !color) return;
+
+	rec_frame_header fh = {};
+	fh.frame_number = snap.frame_number;
+	fh.depth_timestamp = depth.get_timestamp();
+	fh.color_timestamp = color.get_timestamp();
+	fh.system_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	const size_t depth_pixels = (size_t)depth.get_width() * depth.get_height();
+	fh.depth_bytes = (uint32_t)(_cfg.compress_depth ? rvl_max_bytes(depth_pixels) : depth_pixels * 2);	// worst case until encoded
+	fh.color_bytes = (uint32_t)color.get_width() * color.get_height() * 3;
+	fh.exposure = metadata_or(depth, RS2_FRAME_METADATA_ACTUAL_EXPOSURE);
+	fh.gain = metadata_or(depth, RS2_FRAME_METADATA_GAIN_LEVEL);
+	fh.laser_power = metadata_or(depth, RS2_FRAME_METADATA_FRAME_LASER_POWER);
+	fh.timestamp_domain = (uint32_t)depth.get_frame_timestamp_domain();
+
+	uint64_t record = rec_record_size(fh);
+	if (sizeof(rec_chunk_header) + record > _chunk.size())
+	{
+		std::cout << "Recorder chunk too small for one frame (" << record << " bytes)" << std::endl;
+		_dropped++;
+		return;
+	}
+
+	if (_chunk_used + record > _chunk.size()) flush_chunk();
+	if (!_file) open_file(snap);
+	if (!_file)
+	{
+		_dropped++;
+		return;
+	}
+	if (!_chunk_used) _chunk_used = sizeof(rec_chunk_header);	// header written on flush
+
+	uint8_t* dst = _chunk.data() + _chunk_used;
+	if (_cfg.compress_depth)
+	{
+		// encoded straight into the chunk, the record shrinks to the payload
+		auto samples = (const uint16_t*)depth.get_data();
+		if ((size_t)depth.get_stride_in_bytes() != (size_t)depth.get_width() * 2)
+		{
+			_packed.resize(depth_pixels);
+			copy_packed(depth, (uint8_t*)_packed.data());
+			samples = _packed.data();
+		}
+		fh.depth_bytes = (uint32_t)rvl_encode(samples, depth_pixels, dst + sizeof(fh));
+		record = rec_record_size(fh);
+	}
+	else
+		copy_packed(depth, dst + sizeof(fh));
+	memcpy(dst, &fh, sizeof(fh));
+	copy_packed(color, dst + sizeof(fh) + fh.depth_bytes);
+	memset(dst + sizeof(fh) + fh.depth_bytes + fh.color_bytes, 0,
+		(size_t)(record - sizeof(fh) - fh.depth_bytes - fh.color_bytes));
+
+	_index.push_back({ fh.frame_number, fh.depth_timestamp, _file_bytes + _chunk_used });
+	_chunk_used += (size_t)record;
+	_chunk_frames++;
+	_recorded++;
+}
+
+void frame_recorder::flush_chunk()
+{
+	if (!_file || !_chunk_frames) return;
+
+	rec_chunk_header ch = { rec_chunk_magic, _chunk_frames, _chunk_used - sizeof(rec_chunk_header) };
+	memcpy(_chunk.data(), &ch, sizeof(ch));
+	if (fwrite(_chunk.data(), 1, _chunk_used, _file) != _chunk_used)
+		std::cout << "Recorder write failed : " << _file_name << std::endl;
+	_file_bytes += _chunk_used;
+	_chunk_used = 0;
+	_chunk_frames = 0;
+
+	// rotate by size or time, the next frame opens a new file
+	bool too_big = _cfg.max_file_bytes && _file_bytes >= _cfg.max_file_bytes;
+	bool too_old = _cfg.max_file_seconds &&
+		std::chrono::steady_clock::now() - _file_opened >= std::chrono::seconds(_cfg.max_file_seconds);
+	if (too_big || too_old) close_file();
+}
+
+void frame_recorder::open_file(const frame_snapshot& first)
+{
+	auto depth = first.depth.as<rs2::video_frame>();
+	auto color = first.color.as<rs2::video_frame>();
+	auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+
+	std::stringstream name;
+	name << _cfg.directory << "/" << _cfg.prefix << "_" << now_ms / 1000 << "_" << _file_seq++ << ".rsrec";
+
+	_file = open_for_write(name.str());
+	if (!_file)
+	{
+		std::cout << "Recorder cannot open : " << name.str() << std::endl;
+		return;
+	}
+
+	rec_file_header h = {};
+	memcpy(h.magic, rec_magic, sizeof(h.magic));
+	h.version = 2;
+	h.header_size = sizeof(rec_file_header);
+	h.depth_width = depth.get_width();
+	h.depth_height = depth.get_height();
+	h.color_width = color.get_width();
+	h.color_height = color.get_height();
+	h.depth_scale = _cfg.depth_scale;
+	h.chunk_bytes = (uint32_t)_chunk.size();
+	h.created_ms = (uint64_t)now_ms;
+	h.depth_codec = _cfg.compress_depth ? rec_depth_rvl : rec_depth_raw;
+	fwrite(&h, sizeof(h), 1, _file);
+
+	_file_bytes = sizeof(h);
+	_file_opened = std::chrono::steady_clock::now();
+	_index.clear();
+	{
+		std::lock_guard<std::mutex> lock(_name_mutex);
+		_file_name = name.str();
+	}
+	std::cout << "Recording : " << name.str() << std::endl;
+}
+
+void frame_recorder::close_file()
+{
+	if (!_file) return;
+	flush_chunk();
+	if (!_file) return;					// flush_chunk rotated and closed already
+
+	rec_footer footer = {};
+	footer.index_offset = _file_bytes;
+	footer.frame_count = _index.size();
+	memcpy(footer.magic, rec_index_magic, sizeof(footer.magic));
+	if (!_index.empty())
+		fwrite(_index.data(), sizeof(rec_index_entry), _index.size(), _file);
+	fwrite(&footer, sizeof(footer), 1, _file);
+	fclose(_file);
+	_file = nullptr;
+	_index.clear();
+}
+
+recording_reader::recording_reader(const std::string& filename)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (file == INVALID_HANDLE_VALUE) throw std::runtime_error("cannot open " + filename);
+	LARGE_INTEGER size;
+	GetFileSizeEx(file, &size);
+	_size = (uint64_t)size.QuadPart;
+	_file_handle = file;
+	if (_size)
+	{
+		_map_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (_map_handle) _data = (const uint8_t*)MapViewOfFile(_map_handle, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	_fd = open(filename.c_str(), O_RDONLY);
+	if (_fd < 0) throw std::runtime_error("cannot open " + filename);
+	struct stat st;
+	fstat(_fd, &st);
+	_size = (uint64_t)st.st_size;
+	if (_size)
+	{
+		void* p = mmap(nullptr, (size_t)_size, PROT_READ, MAP_SHARED, _fd, 0);
+		if (p != MAP_FAILED) _data = (const uint8_t*)p;
+	}
+#endif
+	if (!_data || _size < sizeof(rec_file_header) || memcmp(header().magic, rec_magic, sizeof(rec_magic)))
+	{
+		unmap();
+		throw std::runtime_error("not a recording : " + filename);
+	}
+	try
+	{
+		build_index();
+	}
+	catch (...)
+	{
+		unmap();							// the destructor does not run
+		throw;
+	}
+}
+
+recording_reader::~recording_reader()
+{
+	unmap();
+}
+
+void recording_reader::unmap()
+{
+#ifdef _WIN32
+	if (_data) UnmapViewOfFile(_data);
+	if (_map_handle) CloseHandle(_map_handle);
+	if (_file_handle) CloseHandle(_file_handle);
+	_map_handle = _file_handle = nullptr;
+#else
+	if (_data) munmap((void*)_data, (size_t)_size);
+	if (_fd >= 0) close(_fd);
+	_fd = -1;
+#endif
+	_data = nullptr;
+}
+
+// a frame record that lies in [offset, end) of the map and matches the file header, so frame() and
+// read_depth() can take its sizes as they are. Subtractions only : nothing read from the file can wrap
+bool recording_reader::record_fits(uint64_t offset, uint64_t end) const
+{
+	if (end > _size || offset > end || end - offset < sizeof(rec_frame_header)) return false;
+	auto fh = (const rec_frame_header*)(_data + offset);
+	const uint64_t room = end - offset - sizeof(rec_frame_header);
+	if ((uint64_t)fh->depth_bytes > room || (uint64_t)fh->color_bytes > room - fh->depth_bytes) return false;
+	if (fh->color_bytes != (uint64_t)header().color_width * header().color_height * 3) return false;
+	if (header().depth_codec == rec_depth_raw && fh->depth_bytes != (uint64_t)header().depth_width * header().depth_height * 2)
+		return false;
+	return true;
+}
+
+void recording_reader::build_index()
+{
+	const uint64_t header_size = header().header_size;
+	if (header_size < sizeof(rec_file_header) || header_size > _size)
+		throw std::runtime_error("corrupt recording header");
+
+	// closed file : the footer points at the index, which ends right before it
+	if (_size - header_size >= sizeof(rec_footer))
+	{
+		auto footer = (const rec_footer*)(_data + _size - sizeof(rec_footer));
+		const uint64_t index_end = _size - sizeof(rec_footer);
+		if (!memcmp(footer->magic, rec_index_magic, sizeof(rec_index_magic)) &&
+			footer->frame_count <= (index_end - header_size) / sizeof(rec_index_entry) &&
+			footer->index_offset == index_end - footer->frame_count * sizeof(rec_index_entry))
+		{
+			auto first = (const rec_index_entry*)(_data + footer->index_offset);
+			_index.assign(first, first + footer->frame_count);
+			bool valid = true;
+			for (auto& e : _index)
+				if (e.offset < header_size || !record_fits(e.offset, footer->index_offset)) { valid = false; break; }
+			if (valid)
+			{
+				_has_footer = true;
+				return;
+			}
+			_index.clear();						// a bad entry : rebuild from the chunks
+		}
+	}
+
+	// unterminated file : walk the complete chunks, up to the first one that does not hold together
+	uint64_t pos = header_size;
+	while (_size - pos >= sizeof(rec_chunk_header))
+	{
+		auto ch = (const rec_chunk_header*)(_data + pos);
+		const uint64_t fpos_first = pos + sizeof(rec_chunk_header);
+		if (ch->magic != rec_chunk_magic || ch->payload_bytes > _size - fpos_first) break;
+		const uint64_t chunk_end = fpos_first + ch->payload_bytes;
+		const size_t chunk_first = _index.size();
+		uint64_t fpos = fpos_first;
+		for (uint32_t i = 0; i < ch->frame_count; i++)
+		{
+			if (!record_fits(fpos, chunk_end))
+			{
+				_index.resize(chunk_first);		// the whole chunk is suspect
+				return;
+			}
+			auto fh = (const rec_frame_header*)(_data + fpos);
+			_index.push_back({ fh->frame_number, fh->depth_timestamp, fpos });
+			fpos += std::min(rec_record_size(*fh), chunk_end - fpos);
+		}
+		pos = chunk_end;
+	}
+}
+
+recording_reader::frame_view recording_reader::frame(size_t n) const
+{
+	if (n >= _index.size()) throw std::out_of_range("frame index out of range");
+	auto p = _data + _index[n].offset;
+	frame_view v;
+	v.header = (const rec_frame_header*)p;
+	v.depth_data = p + sizeof(rec_frame_header);
+	v.depth = header().depth_codec == rec_depth_raw ? (const uint16_t*)v.depth_data : nullptr;
+	v.color = p + sizeof(rec_frame_header) + v.header->depth_bytes;
+	return v;
+}
+
+bool recording_reader::read_depth(const frame_view& v, uint16_t* out) const
+{
+	const size_t pixels = (size_t)header().depth_width * header().depth_height;
+	switch (header().depth_codec)
+	{
+	case rec_depth_raw:
+		if (v.header->depth_bytes != pixels * 2) return false;
+		memcpy(out, v.depth_data, pixels * 2);
+		return true;
+	case rec_depth_rvl:
+		return rvl_decode(v.depth_data, v.header->depth_bytes, out, pixels);
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,199 @@
+// frame_recorder.h : continuous recording into a chunked, indexed binary file
+//
+// File layout (.rsrec, little endian)
+//
+//   rec_file_header
+//   chunk*            rec_chunk_header, then frame_count x (rec_frame_header, depth, RGB8 colour)
+//                     each frame record padded to rec_align bytes so the pixel data stays aligned
+//   rec_index_entry*  one per frame, offset of its rec_frame_header
+//   rec_footer
+//
+// Frames are copied into a preallocated chunk buffer and written with one
+// large sequential write per chunk. The index and footer are only written
+// when a file is closed; recording_reader rebuilds the index by walking the
+// chunks when the footer is missing (e.g. after a crash).
+//
+// Version 2 files store the depth RVL compressed (rec_file_header::depth_codec,
+// depth_codec.h), about a third of the Z16 size; version 1 files (raw Z16,
+// depth_codec reads as 0 from the reserved bytes) are still readable.
+
+#pragma once
+
+#include "frame_snapshot.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#pragma pack(push, 1)
+struct rec_file_header
+{
+	char magic[8];						// "RSREC001"
+	uint32_t version;
+	uint32_t header_size;				// sizeof(rec_file_header)
+	uint32_t depth_width, depth_height;
+	uint32_t color_width, color_height;
+	float depth_scale;					// meters per Z16 unit
+	uint32_t chunk_bytes;				// max payload of one chunk
+	uint64_t created_ms;				// unix time
+	uint32_t depth_codec;				// rec_depth_raw / rec_depth_rvl, version 2
+	uint8_t reserved[12];
+};
+
+struct rec_chunk_header
+{
+	uint32_t magic;						// rec_chunk_magic
+	uint32_t frame_count;
+	uint64_t payload_bytes;				// bytes following this header
+};
+
+struct rec_frame_header
+{
+	uint64_t frame_number;
+	double depth_timestamp;				// ms, camera domain
+	double color_timestamp;
+	int64_t system_time_us;				// host time when recorded
+	uint32_t depth_bytes;				// raw : width * height * 2, tightly packed; rvl : payload size
+	uint32_t color_bytes;				// width * height * 3, tightly packed
+	int32_t exposure;					// frame metadata, -1 when not supported
+	int32_t gain;
+	int32_t laser_power;
+	uint32_t timestamp_domain;
+	uint8_t reserved[8];
+};
+
+struct rec_index_entry
+{
+	uint64_t frame_number;
+	double timestamp;
+	uint64_t offset;					// file offset of the rec_frame_header
+};
+
+struct rec_footer
+{
+	uint64_t index_offset;
+	uint64_t frame_count;
+	char magic[8];						// "RSRECIDX"
+	uint64_t reserved;
+};
+#pragma pack(pop)
+
+const uint32_t rec_chunk_magic = 0x4B4E4843;	// "CHNK"
+const uint64_t rec_align = 16;
+
+enum rec_depth_codec : uint32_t
+{
+	rec_depth_raw = 0,					// Z16, tightly packed
+	rec_depth_rvl = 1					// RVL payload (depth_codec.h)
+};
+
+inline uint64_t rec_record_size(const rec_frame_header& h)
+{
+	return (sizeof(rec_frame_header) + h.depth_bytes + h.color_bytes + rec_align - 1) & ~(rec_align - 1);
+}
+
+struct recorder_config
+{
+	std::string directory = "output_record";
+	std::string prefix = "rec";
+	size_t chunk_bytes = 32 << 20;		// one sequential write
+	size_t queue_size = 8;				// pinned snapshots waiting for the writer
+	uint64_t max_file_bytes = 4ull << 30;	// rotate by size ...
+	unsigned int max_file_seconds = 600;	// ... or by time, 0 = off
+	float depth_scale = 0.001f;
+	bool compress_depth = true;			// RVL, on the writer thread
+};
+
+class frame_recorder
+{
+public:
+	explicit frame_recorder(const recorder_config& cfg);
+	~frame_recorder();					// writes the remaining frames and closes the file
+
+	// Processing thread : never blocks, returns false (counted) when the writer is behind
+	bool push(const frame_snapshot& snap);
+
+	unsigned long long recorded() const { return _recorded; }
+	unsigned long long dropped() const { return _dropped; }
+	std::string current_file() const;
+
+private:
+	void writer();
+	void append(const frame_snapshot& snap);
+	void flush_chunk();
+	void open_file(const frame_snapshot& first);
+	void close_file();
+
+	recorder_config _cfg;
+
+	// preallocated ring of pinned snapshots
+	std::vector<frame_snapshot> _ring;
+	size_t _head = 0, _count = 0;
+	bool _stopping = false;
+	std::mutex _mutex;
+	std::condition_variable _cv;
+
+	// writer thread state
+	FILE* _file = nullptr;
+	std::string _file_name;
+	mutable std::mutex _name_mutex;
+	unsigned int _file_seq = 0;
+	uint64_t _file_bytes = 0;
+	std::chrono::steady_clock::time_point _file_opened;
+	std::vector<uint8_t> _chunk;		// chunk_bytes, allocated once
+	std::vector<uint16_t> _packed;		// depth with padded rows, repacked before encoding
+	size_t _chunk_used = 0;
+	uint32_t _chunk_frames = 0;
+	std::vector<rec_index_entry> _index;
+
+	std::atomic<unsigned long long> _recorded{ 0 };
+	std::atomic<unsigned long long> _dropped{ 0 };
+	std::thread _thread;
+};
+
+// Memory-mapped read access, frame N is located through the index without touching other frames
+class recording_reader
+{
+public:
+	struct frame_view
+	{
+		const rec_frame_header* header;
+		const uint16_t* depth;			// depth_width * depth_height, nullptr when compressed
+		const uint8_t* depth_data;		// header->depth_bytes as stored
+		const uint8_t* color;			// color_width * color_height * 3
+	};
+
+	explicit recording_reader(const std::string& filename);	// throws std::runtime_error, also on a corrupt header
+	~recording_reader();
+	recording_reader(const recording_reader&) = delete;
+	recording_reader& operator=(const recording_reader&) = delete;
+
+	const rec_file_header& header() const { return *(const rec_file_header*)_data; }
+	size_t frame_count() const { return _index.size(); }
+	frame_view frame(size_t n) const;	// throws std::out_of_range
+	// depth_width * depth_height samples of a frame into out, whatever the codec; false if corrupt
+	bool read_depth(const frame_view& v, uint16_t* out) const;
+	bool has_footer() const { return _has_footer; }
+
+private:
+	void build_index();
+	bool record_fits(uint64_t offset, uint64_t end) const;
+	void unmap();
+
+	const uint8_t* _data = nullptr;
+	uint64_t _size = 0;
+	bool _has_footer = false;
+	std::vector<rec_index_entry> _index;
+#ifdef _WIN32
+	void* _file_handle = nullptr;
+	void* _map_handle = nullptr;
+#else
+	int _fd = -1;
+#endif
+};
@@ -0,0 +1,128 @@
+// frame_ring.cpp : pre-trigger ring of the last aligned, filtered snapshots
+//
+
+#include "frame_ring.h"
+
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+frame_ring::frame_ring(size_t max_frames, size_t max_bytes)
+	: _slots(max_frames ? max_frames : 1), _max_bytes(max_bytes)
+{
+}
+
+void frame_ring::set_max_frames(size_t max_frames)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_slots.assign(max_frames ? max_frames : 1, slot());
+	_head = _count = _bytes = 0;
+}
+
+static size_t frame_bytes(const rs2::frame& f)
+{
+	auto vf = f.as<rs2::video_frame>();
+	return vf ? (size_t)vf.get_stride_in_bytes() * vf.get_height() : 0;
+}
+
+size_t frame_ring::snapshot_bytes(const frame_snapshot& snap)
+{
+	return frame_bytes(snap.colorized) + frame_bytes(snap.color) + frame_bytes(snap.depth);
+}
+
+void frame_ring::push(const frame_snapshot& snap)
+{
+	const size_t bytes = snapshot_bytes(snap);		// outside the lock, only reads the frame headers
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (_count == _slots.size()) pop_oldest();
+	while (_max_bytes && _count && _bytes + bytes > _max_bytes)
+	{
+		pop_oldest();
+		_evicted++;
+	}
+	slot& s = _slots[(_head + _count) % _slots.size()];
+	s.snap = snap;							// slot reused, no allocation
+	s.bytes = bytes;
+	_bytes += bytes;
+	_count++;
+	_pushed++;
+}
+
+void frame_ring::pop_oldest()
+{
+	slot& s = _slots[_head];
+	s.snap = frame_snapshot();				// release the frames back to their pools now
+	_bytes -= s.bytes;
+	s.bytes = 0;
+	_head = (_head + 1) % _slots.size();
+	_count--;
+}
+
+std::vector<frame_snapshot> frame_ring::history() const
+{
+	std::vector<frame_snapshot> out;
+	out.reserve(_slots.size());
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (size_t i = 0; i < _count; i++) out.push_back(_slots[(_head + i) % _slots.size()].snap);
+	return out;
+}
+
+frame_snapshot frame_ring::newest() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _count ? _slots[(_head + _count - 1) % _slots.size()].snap : frame_snapshot();
+}
+
+std::vector<frame_snapshot> frame_ring::range(unsigned long long first, unsigned long long last,
+	std::chrono::milliseconds timeout) const
+{
+	// polled : the producer does not signal, and a trigger waits a few frame periods at most
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (newest().frame_number < last && std::chrono::steady_clock::now() < deadline)
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+	std::vector<frame_snapshot> out;
+	for (auto& snap : history())
+		if (snap.frame_number >= first && snap.frame_number <= last) out.push_back(snap);
+	return out;
+}
+
+size_t frame_ring::size() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _count;
+}
+
+size_t frame_ring::bytes() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _bytes;
+}
+
+double depth_fill_rate(const rs2::frame& depth)
+{
+	auto vf = depth.as<rs2::video_frame>();
+	if (!vf || vf.get_bytes_per_pixel() != 2 || !vf.get_width() || !vf.get_height()) return 0;
+
+	const int w = vf.get_width(), h = vf.get_height();
+	auto base = (const uint8_t*)vf.get_data();
+	uint64_t valid = 0;
+	for (int y = 0; y < h; y++)
+	{
+		auto row = (const uint16_t*)(base + (size_t)y * vf.get_stride_in_bytes());
+		uint32_t n = 0;
+		for (int x = 0; x < w; x++) n += row[x] != 0;	// vectorises
+		valid += n;
+	}
+	return (double)valid / ((double)w * h);
+}
+
+frame_snapshot nearest_snapshot(const std::vector<frame_snapshot>& frames, double timestamp)
+{
+	frame_snapshot best;
+	for (auto& snap : frames)
+		if (snap && (!best || std::fabs(snap.timestamp - timestamp) < std::fabs(best.timestamp - timestamp)))
+			best = snap;
+	return best;
+}
@@ -0,0 +1,80 @@
+// frame_ring.h : pre-trigger ring of the last aligned, filtered snapshots
+//
+// A capture key is read through getchar(), so the newest frame when the key
+// is seen is often later than the frame the operator meant. The ring keeps
+// the last snapshots as rs2::frame references (no pixel copy) so a capture
+// can take frames T-k .. T+k around the trigger, or the most complete frame
+// of the last few hundred milliseconds.
+//
+// The ring is bounded by a frame count and by the bytes the pinned frames
+// hold; the oldest snapshot is released first. Pinned frames stay in their
+// librealsense pools, so whoever owns the ring must grow those pools by
+// max_frames() (RS2_OPTION_FRAMES_QUEUE_SIZE, see depth_pipeline::reserve_frames)
+// or the camera runs out of frames to deliver.
+//
+// Readers hold the lock only while they copy the frame references (a few
+// microseconds for a full ring), so the producer (colorize thread) takes it
+// too rather than skip a frame a trigger may ask for.
+
+#pragma once
+
+#include "frame_snapshot.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+class frame_ring
+{
+public:
+	// max_frames : snapshots kept, max_bytes : pixel data they may pin, 0 = count only
+	frame_ring(size_t max_frames, size_t max_bytes);
+
+	// producer only : releases the oldest snapshots over the count / byte budget
+	void push(const frame_snapshot& snap);
+
+	// any thread : the snapshots in the ring, oldest first
+	std::vector<frame_snapshot> history() const;
+	frame_snapshot newest() const;
+
+	// snapshots with first <= frame number <= last, oldest first; waits up to timeout
+	// for last to arrive (frames after the trigger), returns what the ring has then
+	std::vector<frame_snapshot> range(unsigned long long first, unsigned long long last,
+		std::chrono::milliseconds timeout) const;
+
+	size_t max_frames() const { return _slots.size(); }
+	void set_max_frames(size_t max_frames);	// before the first push : the pools could not grow by max_frames()
+	size_t max_bytes() const { return _max_bytes; }
+	size_t size() const;
+	size_t bytes() const;
+	unsigned long long pushed() const { return _pushed; }
+	unsigned long long evicted() const { return _evicted; }		// released early by the byte budget
+
+	// bytes of pixel data a snapshot pins
+	static size_t snapshot_bytes(const frame_snapshot& snap);
+
+private:
+	struct slot
+	{
+		frame_snapshot snap;
+		size_t bytes = 0;
+	};
+
+	void pop_oldest();						// _mutex held
+
+	std::vector<slot> _slots;				// preallocated, reused in place
+	const size_t _max_bytes;
+	size_t _head = 0, _count = 0, _bytes = 0;
+	mutable std::mutex _mutex;
+
+	std::atomic<unsigned long long> _pushed{ 0 };
+	std::atomic<unsigned long long> _evicted{ 0 };
+};
+
+// fraction of the samples of a Z16 frame that have depth (non-zero), 0 for an empty frame
+double depth_fill_rate(const rs2::frame& depth);
+
+// the snapshot of frames with the timestamp nearest to timestamp, empty if none
+frame_snapshot nearest_snapshot(const std::vector<frame_snapshot>& frames, double timestamp);
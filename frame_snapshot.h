@@ -0,0 +1,88 @@
+// frame_snapshot.h : latest matched snapshot, single producer / many readers
+//
+// The processing block publishes colorized depth, aligned colour and the
+// filtered Z16 depth of one frameset as a single unit. Readers (render,
+// capture) take a copy of the latest unit without a mutex.
+//
+// latest_slot keeps N slots. The producer only writes a slot that is neither
+// published nor held by a reader, then publishes its index. A reader marks
+// the slot it is about to copy and re-checks that it is still the published
+// one, so the producer can never overwrite a slot during the copy. All
+// atomics are sequentially consistent, which is what makes the
+// mark / re-check pair safe against the producer's check / publish pair.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <atomic>
+#include <cstddef>
+
+struct frame_snapshot
+{
+	rs2::frame colorized;					// RGB8 colorized depth
+	rs2::frame color;						// RGB8 colour, aligned to depth
+	rs2::frame depth;						// Z16 filtered depth
+	unsigned long long frame_number = 0;	// depth frame number, 0 = empty snapshot
+	double timestamp = 0;					// depth timestamp (ms)
+
+	explicit operator bool() const { return frame_number != 0; }
+};
+
+template<class T, size_t N = 4>
+class latest_slot
+{
+	static_assert(N >= 3, "latest_slot needs a published, a writable and a reader slot");
+
+public:
+	latest_slot()
+	{
+		for (auto& r : _readers) r = 0;
+	}
+
+	// producer only : returns false (and skips the value) when every slot is busy
+	bool publish(const T& value)
+	{
+		size_t current = _published.load();
+		for (size_t i = 0; i < N; i++)
+		{
+			if (i == current || _readers[i].load() != 0) continue;
+			_slots[i] = value;
+			_published.store(i);
+			_count++;
+			return true;
+		}
+		_skipped++;
+		return false;
+	}
+
+	// any thread : copy of the latest published value, default T before the first publish
+	T latest() const
+	{
+		while (true)
+		{
+			size_t i = _published.load();
+			if (i == none) return T();
+			_readers[i]++;
+			if (_published.load() == i)
+			{
+				T copy = _slots[i];
+				_readers[i]--;
+				return copy;
+			}
+			_readers[i]--;				// superseded while marking, retry with the new one
+		}
+	}
+
+	unsigned long long published() const { return _count; }
+	unsigned long long skipped() const { return _skipped; }
+
+private:
+	static const size_t none = (size_t)-1;
+
+	T _slots[N];
+	mutable std::atomic<int> _readers[N];
+	std::atomic<size_t> _published{ none };
+	std::atomic<unsigned long long> _count{ 0 };
+	std::atomic<unsigned long long> _skipped{ 0 };
+};
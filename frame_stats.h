@@ -0,0 +1,81 @@
+// frame_stats.h : per-stage queue depth and dropped-frame counters
+//
+// A stage counts frames pushed into its queue and frames taken out of it.
+// Frames silently discarded by a bounded queue (rs2::frame_queue drops the
+// oldest frame when full) are found as gaps in the frame number seen by the
+// consumer, so  depth = pushed - popped - dropped.
+// Lossless queues between pipeline stages use pop_lossless() instead : a gap
+// there was lost upstream, and a frame number going backwards is counted as
+// out of order.
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <iostream>
+
+struct stage_stats
+{
+	explicit stage_stats(const std::string& stage_name) : name(stage_name) {}
+
+	// producer side : frame entered the stage queue
+	void push()
+	{
+		pushed++;
+		long long d = depth();
+		if (d > peak) peak = d;
+	}
+
+	// consumer side : frame left the stage queue, frame number gaps are counted as drops
+	void pop(unsigned long long frame_number)
+	{
+		popped++;
+		unsigned long long last = last_number.exchange(frame_number);
+		if (last && frame_number > last + 1)
+			dropped += frame_number - last - 1;
+	}
+
+	// consumer side of a queue that never drops
+	void pop_lossless(unsigned long long frame_number)
+	{
+		popped++;
+		unsigned long long last = last_number.exchange(frame_number);
+		if (last && frame_number <= last)
+			reordered++;
+	}
+
+	// source stage (camera) : there is no queue of our own, frames lost upstream
+	// are counted as pushed and dropped so depth stays at zero
+	void arrive(unsigned long long frame_number)
+	{
+		unsigned long long last = last_number.load();
+		if (last && frame_number > last + 1)
+			pushed += frame_number - last - 1;
+		push();
+		pop(frame_number);
+	}
+
+	long long depth() const
+	{
+		return (long long)pushed.load() - (long long)popped.load() - (long long)dropped.load();
+	}
+
+	void print(std::ostream& os) const
+	{
+		os << name << " : depth " << depth()
+			<< ", in " << pushed.load()
+			<< ", out " << popped.load()
+			<< ", dropped " << dropped.load();
+		if (peak) os << ", peak " << peak.load();
+		if (reordered) os << ", out of order " << reordered.load();
+		os << std::endl;
+	}
+
+	std::string name;
+	std::atomic<unsigned long long> pushed{ 0 };
+	std::atomic<unsigned long long> popped{ 0 };
+	std::atomic<unsigned long long> dropped{ 0 };
+	std::atomic<unsigned long long> last_number{ 0 };
+	std::atomic<long long> peak{ 0 };						// highest depth seen by push()
+	std::atomic<unsigned long long> reordered{ 0 };
+};
@@ -0,0 +1,235 @@
+// frame_telemetry.cpp : per-frame metadata ring and its flush thread
+//
+
+#include "frame_telemetry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static const char telemetry_magic[8] = { 'R', 'S', 'T', 'E', 'L', '0', '0', '1' };
+
+frame_telemetry::frame_telemetry(const telemetry_config& cfg)
+	: _cfg(cfg), _ring(cfg.ring_records ? cfg.ring_records : 1), _batch(_ring.size())
+{
+#ifdef _MSC_VER
+	if (fopen_s(&_file, _cfg.filename.c_str(), "wb")) _file = nullptr;
+#else
+	_file = fopen(_cfg.filename.c_str(), "wb");
+#endif
+	if (!_file)
+	{
+		std::cout << "Telemetry cannot open : " << _cfg.filename << std::endl;
+		return;
+	}
+	if (_cfg.binary)
+	{
+		telemetry_file_header h = {};
+		memcpy(h.magic, telemetry_magic, sizeof(h.magic));
+		h.header_size = sizeof(h);
+		h.record_size = sizeof(telemetry_record);
+		h.metadata_count = RS2_FRAME_METADATA_COUNT;
+		fwrite(&h, sizeof(h), 1, _file);
+	}
+	else
+		write_csv_header();
+	std::cout << "Telemetry : " << _cfg.filename << std::endl;
+	_thread = std::thread([this]() { flusher(); });
+}
+
+frame_telemetry::~frame_telemetry()
+{
+	stop();
+	if (_file) fclose(_file);
+}
+
+void frame_telemetry::stop()
+{
+	if (!_thread.joinable()) return;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_cv.notify_one();
+	_thread.join();
+}
+
+bool frame_telemetry::log(const frame_snapshot& snap)
+{
+	if (!_file || !snap) return false;
+	const int64_t host_us = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	bool ok = push(snap.depth, host_us);
+	if (snap.color) ok = push(snap.color, host_us) && ok;
+	return ok;
+}
+
+bool frame_telemetry::push(const rs2::frame& f, int64_t host_us)
+{
+	size_t tail = _tail.load(std::memory_order_relaxed);
+	if (tail - _head.load(std::memory_order_acquire) == _ring.size())
+	{
+		_dropped++;
+		return false;
+	}
+
+	// filled in place, the slot is the flush thread's once _tail moves past it
+	telemetry_record& r = _ring[tail % _ring.size()];
+	r.frame_number = f.get_frame_number();
+	r.timestamp = f.get_timestamp();
+	r.host_time_us = host_us;
+	r.timestamp_domain = (uint32_t)f.get_frame_timestamp_domain();
+	auto profile = f.get_profile();
+	r.stream = (uint8_t)profile.stream_type();
+	r.camera = (uint8_t)_cfg.camera;
+	r.fps = (uint16_t)profile.fps();
+	r.supported = 0;
+	for (int i = 0; i < RS2_FRAME_METADATA_COUNT; i++)
+	{
+		auto v = (rs2_frame_metadata_value)i;
+		if (!f.supports_frame_metadata(v)) continue;
+		r.metadata[i] = (int64_t)f.get_frame_metadata(v);
+		r.supported |= 1ull << i;
+	}
+	r.gap = 0;
+	r.interval_ms = r.jitter_ms = 0;
+	r.latency_ms = -1;
+
+	_tail.store(tail + 1, std::memory_order_release);
+	_logged++;
+	return true;
+}
+
+void frame_telemetry::flusher()
+{
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (!_stopping)
+	{
+		_cv.wait_for(lock, std::chrono::milliseconds(_cfg.flush_ms), [this]() { return _stopping; });
+		lock.unlock();
+		flush();
+		lock.lock();
+	}
+	lock.unlock();
+	flush();								// records logged before the producer stopped
+}
+
+void frame_telemetry::flush()
+{
+	size_t head = _head.load(std::memory_order_relaxed);
+	size_t n = _tail.load(std::memory_order_acquire) - head;
+	if (!n) return;
+	for (size_t i = 0; i < n; i++) _batch[i] = _ring[(head + i) % _ring.size()];
+	_head.store(head + n, std::memory_order_release);	// slots back to the producer before the I/O
+
+	{
+		std::lock_guard<std::mutex> lock(_stats_mutex);
+		for (size_t i = 0; i < n; i++) derive(_batch[i]);
+	}
+
+	if (_cfg.binary)
+	{
+		fwrite(_batch.data(), sizeof(telemetry_record), n, _file);
+	}
+	else
+	{
+		_text.clear();
+		for (size_t i = 0; i < n; i++) append_csv(_batch[i]);
+		fwrite(_text.data(), 1, _text.size(), _file);
+	}
+	fflush(_file);
+}
+
+void frame_telemetry::derive(telemetry_record& r)
+{
+	stream_state& s = r.stream == RS2_STREAM_COLOR ? _color : _depth;
+	if (s.frames)
+	{
+		if (r.frame_number > s.last_number + 1)
+		{
+			r.gap = (uint32_t)(r.frame_number - s.last_number - 1);
+			s.gaps += r.gap;
+		}
+		r.interval_ms = (float)(r.timestamp - s.last_timestamp);
+		// against the gap + 1 frame periods the interval spans, so a drop is counted as a gap, not as jitter
+		if (r.fps) r.jitter_ms = r.interval_ms - (r.gap + 1) * 1000.f / r.fps;
+		s.jitter.record_us((uint64_t)std::fabs(r.jitter_ms * 1000.f));
+	}
+	if (r.supported & (1ull << RS2_FRAME_METADATA_TIME_OF_ARRIVAL))
+	{
+		r.latency_ms = (float)(r.host_time_us / 1000.0 - (double)r.metadata[RS2_FRAME_METADATA_TIME_OF_ARRIVAL]);
+		s.latency.record_us((uint64_t)std::max(0.f, r.latency_ms * 1000.f));
+	}
+	s.last_number = r.frame_number;
+	s.last_timestamp = r.timestamp;
+	s.frames++;
+}
+
+void frame_telemetry::write_csv_header()
+{
+	std::string header = "camera,stream,frame_number,timestamp_ms,timestamp_domain,host_time_us,gap,interval_ms,jitter_ms,latency_ms";
+	for (int i = 0; i < RS2_FRAME_METADATA_COUNT; i++)
+	{
+		header += ",";
+		header += rs2_frame_metadata_to_string((rs2_frame_metadata_value)i);
+	}
+	header += "\n";
+	fwrite(header.data(), 1, header.size(), _file);
+}
+
+void frame_telemetry::append_csv(const telemetry_record& r)
+{
+	char buf[256];
+	int n = snprintf(buf, sizeof(buf), "%u,%s,%llu,%.3f,%u,%lld,%u,%.3f,%.3f,",
+		r.camera, r.stream == RS2_STREAM_COLOR ? "color" : "depth", (unsigned long long)r.frame_number, r.timestamp,
+		r.timestamp_domain, (long long)r.host_time_us, r.gap, r.interval_ms, r.jitter_ms);
+	_text.append(buf, (size_t)std::max(0, std::min(n, (int)sizeof(buf) - 1)));
+	if (r.latency_ms >= 0)
+	{
+		n = snprintf(buf, sizeof(buf), "%.3f", r.latency_ms);
+		_text.append(buf, (size_t)std::max(0, n));
+	}
+	for (int i = 0; i < RS2_FRAME_METADATA_COUNT; i++)
+	{
+		_text += ',';
+		if (!(r.supported & (1ull << i))) continue;
+		n = snprintf(buf, sizeof(buf), "%lld", (long long)r.metadata[i]);
+		_text.append(buf, (size_t)std::max(0, n));
+	}
+	_text += '\n';
+}
+
+void frame_telemetry::print(std::ostream& os) const
+{
+	std::lock_guard<std::mutex> lock(_stats_mutex);
+	os << "telemetry : logged " << _logged << ", dropped " << _dropped << std::endl;
+	const stream_state* streams[] = { &_depth, &_color };
+	const char* names[] = { "depth", "color" };
+	for (int i = 0; i < 2; i++)
+	{
+		const stream_state& s = *streams[i];
+		if (!s.frames) continue;
+		os << "  " << names[i] << " : " << s.frames << " frames, " << s.gaps << " missing"
+			<< ", jitter p99 " << s.jitter.percentile_us(0.99) / 1000.0 << " ms max " << s.jitter.max_us() / 1000.0 << " ms";
+		if (s.latency.count())
+			os << ", latency p50 " << s.latency.percentile_us(0.50) / 1000.0 << " ms p99 " << s.latency.percentile_us(0.99) / 1000.0 << " ms";
+		os << std::endl;
+	}
+}
+
+bool metadata_to_csv(const rs2::frame& frm, const std::string& filename)
+{
+	std::ofstream csv(filename);
+	if (!csv) return false;
+
+	csv << "Stream," << rs2_stream_to_string(frm.get_profile().stream_type()) << "\nMetadata Attribute,Value\n";
+	for (int i = 0; i < RS2_FRAME_METADATA_COUNT; i++)
+	{
+		auto v = (rs2_frame_metadata_value)i;
+		if (frm.supports_frame_metadata(v))
+			csv << rs2_frame_metadata_to_string(v) << "," << frm.get_frame_metadata(v) << "\n";
+	}
+	return (bool)csv;
+}
@@ -0,0 +1,135 @@
+// frame_telemetry.h : per-frame metadata log (exposure, gain, laser power, timestamps)
+//
+// The processing thread copies every supported rs2_frame_metadata_value of
+// the depth and colour frame of a snapshot into a preallocated ring of
+// fixed-size records : no allocation, no lock, no I/O. A background thread
+// drains the ring every flush_ms, derives per stream
+//
+//   gap        frames missing before this one (frame number jump - 1)
+//   interval   timestamp - previous timestamp of the stream, jitter = interval - (gap + 1) * 1000 / fps
+//   latency    host time when logged - TIME_OF_ARRIVAL metadata (host time the frame
+//              reached the driver), i.e. transport + align / filter / colorize
+//
+// and writes the batch with one write, as CSV (one column per metadata value,
+// empty when not supported) or as the raw records (.rstel : telemetry_file_header,
+// then telemetry_record*). A full ring drops the record and counts it.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include "frame_snapshot.h"
+#include "latency_histogram.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+const int telemetry_metadata_max = 64;	// metadata slots per record, >= RS2_FRAME_METADATA_COUNT
+static_assert(RS2_FRAME_METADATA_COUNT <= telemetry_metadata_max, "telemetry_record too small for this librealsense");
+
+#pragma pack(push, 1)
+struct telemetry_file_header
+{
+	char magic[8];						// "RSTEL001"
+	uint32_t header_size;				// sizeof(telemetry_file_header)
+	uint32_t record_size;				// sizeof(telemetry_record)
+	uint32_t metadata_count;			// RS2_FRAME_METADATA_COUNT of the writer, metadata[i] is value i
+	uint32_t reserved;
+};
+
+struct telemetry_record
+{
+	uint64_t frame_number;
+	double timestamp;					// ms, timestamp_domain
+	int64_t host_time_us;				// system clock when logged (end of the processing chain)
+	uint32_t timestamp_domain;
+	uint8_t stream;						// rs2_stream
+	uint8_t camera;
+	uint16_t fps;
+	uint64_t supported;					// bit i : metadata[i] is valid
+	int64_t metadata[telemetry_metadata_max];
+	// derived by the flush thread
+	uint32_t gap;
+	float interval_ms;					// 0 for the first frame of a stream
+	float jitter_ms;
+	float latency_ms;					// -1 without TIME_OF_ARRIVAL
+};
+#pragma pack(pop)
+
+struct telemetry_config
+{
+	std::string filename;				// .csv or .rstel
+	bool binary = false;
+	size_t ring_records = 1024;			// ~17 s of depth + colour at 30 fps
+	unsigned int flush_ms = 500;
+	unsigned camera = 0;				// written in every record
+};
+
+class frame_telemetry
+{
+public:
+	explicit frame_telemetry(const telemetry_config& cfg);	// opens the file, starts the flush thread
+	~frame_telemetry();					// stop(), closes the file
+
+	void stop();						// producer done : flushes what is left and joins the flush thread
+
+	// single producer (the camera's colorize thread) : never blocks, false (counted) when the ring is full
+	bool log(const frame_snapshot& snap);
+
+	unsigned long long logged() const { return _logged; }
+	unsigned long long dropped() const { return _dropped; }
+	bool is_open() const { return _file != nullptr; }
+	const std::string& filename() const { return _cfg.filename; }
+
+	// gaps, jitter and latency so far, any thread
+	void print(std::ostream& os) const;
+
+private:
+	struct stream_state
+	{
+		uint64_t last_number = 0;
+		double last_timestamp = 0;
+		unsigned long long frames = 0, gaps = 0;
+		latency_histogram jitter;		// |jitter| in us
+		latency_histogram latency;		// us
+	};
+
+	bool push(const rs2::frame& f, int64_t host_us);
+	void flusher();
+	void flush();						// flush thread
+	void derive(telemetry_record& r);	// flush thread, _stats_mutex held
+	void write_csv_header();
+	void append_csv(const telemetry_record& r);
+
+	telemetry_config _cfg;
+	FILE* _file = nullptr;
+
+	// SPSC ring : producer owns _tail, flush thread owns _head
+	std::vector<telemetry_record> _ring;
+	std::atomic<size_t> _head{ 0 }, _tail{ 0 };
+
+	// flush thread state
+	std::vector<telemetry_record> _batch;	// ring_records, allocated once
+	std::string _text;					// CSV batch, grows to its working size once
+	stream_state _depth, _color;
+	mutable std::mutex _stats_mutex;
+
+	std::atomic<unsigned long long> _logged{ 0 };
+	std::atomic<unsigned long long> _dropped{ 0 };
+	bool _stopping = false;
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	std::thread _thread;
+};
+
+// Helper function for writing metadata to disk as a csv file : every supported
+// metadata value of one frame (stream, attribute, value), next to a capture
+bool metadata_to_csv(const rs2::frame& frm, const std::string& filename);
@@ -0,0 +1,75 @@
+// latency_histogram.h : fixed-size log-linear latency histogram (microseconds)
+//
+// Values below 16 us get their own bucket; above that every power of two is
+// split into 16 sub-buckets, so a percentile is within ~6% of the true value.
+// record() never allocates. Not thread-safe: one writer, read when idle.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+class latency_histogram
+{
+public:
+	latency_histogram() { reset(); }
+
+	void reset()
+	{
+		memset(_counts, 0, sizeof(_counts));
+		_count = 0;
+		_sum = 0;
+		_max = 0;
+	}
+
+	void record_us(uint64_t us)
+	{
+		_counts[index(us)]++;
+		_count++;
+		_sum += us;
+		if (us > _max) _max = us;
+	}
+
+	uint64_t count() const { return _count; }
+	double mean_us() const { return _count ? (double)_sum / _count : 0; }
+	uint64_t max_us() const { return _max; }
+
+	// p in [0, 1], returns the lower bound of the bucket holding that rank
+	uint64_t percentile_us(double p) const
+	{
+		if (!_count) return 0;
+		uint64_t rank = (uint64_t)(p * (_count - 1)) + 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < bucket_count; i++)
+		{
+			seen += _counts[i];
+			if (seen >= rank) return lower_bound(i);
+		}
+		return _max;
+	}
+
+private:
+	static const int sub_buckets = 16;
+	static const int bucket_count = 61 * sub_buckets;
+
+	static int index(uint64_t v)
+	{
+		if (v < sub_buckets) return (int)v;
+		int msb = 4;
+		while (v >> (msb + 1)) msb++;
+		int group = msb - 3;
+		int sub = (int)((v >> (msb - 4)) & (sub_buckets - 1));
+		return group * sub_buckets + sub;
+	}
+
+	static uint64_t lower_bound(int i)
+	{
+		if (i < sub_buckets) return (uint64_t)i;
+		int group = i / sub_buckets;
+		uint64_t sub = (uint64_t)(i % sub_buckets);
+		return (sub_buckets + sub) << (group - 1);
+	}
+
+	uint64_t _counts[bucket_count];
+	uint64_t _count, _sum, _max;
+};
@@ -0,0 +1,205 @@
+// lut_colorizer.cpp : Z16 -> RGB8 lookup-table colorizer
+//
+
+#include "lut_colorizer.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define LUT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(LUT_X86) && defined(__GNUC__)
+#define LUT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define LUT_TARGET(isa)
+#endif
+
+// rs2::colorizer samples its colour map into a cache of this many entries
+static const int rs2_color_map_size = 4000;
+
+// scheme 2 (white to black), the two key colours of the map at 0 and 1
+static const float map_near[3] = { 255.f, 255.f, 255.f };
+static const float map_far[3] = { 0.f, 0.f, 0.f };
+
+static lut_colorizer::kernel_type detect_kernel()
+{
+#ifdef LUT_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	bool ssse3 = (info[2] & (1 << 9)) != 0;
+	bool osxsave_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+	bool avx2 = false;
+	if (osxsave_avx && max_leaf >= 7 && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool ssse3 = __builtin_cpu_supports("ssse3");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+	if (avx2) return lut_colorizer::kernel_avx2;
+	if (ssse3) return lut_colorizer::kernel_ssse3;
+#endif
+	return lut_colorizer::kernel_scalar;
+}
+
+static inline void store_rgb(uint8_t* dst, uint32_t v)
+{
+	dst[0] = (uint8_t)v;
+	dst[1] = (uint8_t)(v >> 8);
+	dst[2] = (uint8_t)(v >> 16);
+}
+
+static void colorize_row_scalar(const uint32_t* lut, const uint16_t* src, uint8_t* dst, int x, int width)
+{
+	for (; x < width; x++)
+		store_rgb(dst + x * 3, lut[src[x]]);
+}
+
+#ifdef LUT_X86
+// 4 pixels per step; the 16 byte store carries 4 bytes of garbage, so keep 2 pixels of slack
+LUT_TARGET("ssse3")
+static int colorize_row_ssse3(const uint32_t* lut, const uint16_t* src, uint8_t* dst, int width)
+{
+	const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int x = 0;
+	for (; x + 4 + 2 <= width; x += 4)
+	{
+		__m128i v = _mm_setr_epi32((int)lut[src[x]], (int)lut[src[x + 1]], (int)lut[src[x + 2]], (int)lut[src[x + 3]]);
+		_mm_storeu_si128((__m128i*)(dst + x * 3), _mm_shuffle_epi8(v, pack));
+	}
+	return x;
+}
+
+// 8 pixels per step : widen, gather, pack each 128 bit lane to 12 bytes
+LUT_TARGET("avx2")
+static int colorize_row_avx2(const uint32_t* lut, const uint16_t* src, uint8_t* dst, int width)
+{
+	const __m256i pack = _mm256_setr_epi8(
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int x = 0;
+	for (; x + 8 + 2 <= width; x += 8)
+	{
+		__m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + x)));
+		__m256i v = _mm256_i32gather_epi32((const int*)lut, idx, 4);
+		v = _mm256_shuffle_epi8(v, pack);
+		_mm_storeu_si128((__m128i*)(dst + x * 3), _mm256_castsi256_si128(v));
+		_mm_storeu_si128((__m128i*)(dst + x * 3 + 12), _mm256_extracti128_si256(v, 1));
+	}
+	return x;
+}
+#endif
+
+lut_colorizer::lut_colorizer(float min_z, float max_z)
+	: _min_z(min_z), _max_z(max_z), _lut(65536, 0)
+{
+	_best_kernel = _kernel = detect_kernel();
+}
+
+void lut_colorizer::set_depth_units(float depth_units)
+{
+	if (depth_units == _depth_units) return;
+	_depth_units = depth_units;
+
+	// Same float steps as rs2::colorizer (fixed range) and its colour map cache :
+	//   f = (d * units - min) / (max - min), clamped to [0, 1]
+	//   i = (int)(f * (size - 1)),  t = i / (size - 1)
+	//   c = far * t + near * (1 - t), truncated to uint8
+	const float min = _min_z, max = _max_z;
+	_lut[0] = 0;							// no depth : black
+	for (int d = 1; d < 65536; d++)
+	{
+		float f = (min >= max) ? 0.f : ((float)d * depth_units - min) / (max - min);
+		if (f < 0.f) f = 0.f;
+		if (f > 1.f) f = 1.f;
+		int i = (int)(f * (rs2_color_map_size - 1));
+		float t = (float)i / (rs2_color_map_size - 1);
+		uint32_t v = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			float value = (t <= 0.f) ? map_near[c] : (t >= 1.f) ? map_far[c] : map_far[c] * t + map_near[c] * (1 - t);
+			v |= (uint32_t)(uint8_t)value << (8 * c);
+		}
+		_lut[d] = v;
+	}
+}
+
+void lut_colorizer::force_kernel(kernel_type k)
+{
+	_kernel = k > _best_kernel ? _best_kernel : k;
+}
+
+const char* lut_colorizer::kernel_name(kernel_type k)
+{
+	switch (k)
+	{
+	case kernel_avx2: return "avx2";
+	case kernel_ssse3: return "ssse3";
+	default: return "scalar";
+	}
+}
+
+void lut_colorizer::colorize(const uint16_t* depth, int width, int height, int depth_stride_bytes,
+	uint8_t* rgb, int rgb_stride_bytes) const
+{
+	const uint32_t* lut = _lut.data();
+	for (int y = 0; y < height; y++)
+	{
+		auto src = (const uint16_t*)((const uint8_t*)depth + (size_t)y * depth_stride_bytes);
+		auto dst = rgb + (size_t)y * rgb_stride_bytes;
+		int x = 0;
+#ifdef LUT_X86
+		if (_kernel == kernel_avx2) x = colorize_row_avx2(lut, src, dst, width);
+		else if (_kernel == kernel_ssse3) x = colorize_row_ssse3(lut, src, dst, width);
+#endif
+		colorize_row_scalar(lut, src, dst, x, width);
+	}
+}
+
+rs2::frame lut_colorizer::process(const rs2::depth_frame& depth, const rs2::frame_source& source)
+{
+	auto profile = depth.get_profile();
+	if (profile.unique_id() != _rgb_profile_source)
+	{
+		_rgb_profile = profile.clone(profile.stream_type(), profile.stream_index(), RS2_FORMAT_RGB8);
+		_rgb_profile_source = profile.unique_id();
+	}
+	set_depth_units(depth.get_units());
+
+	const int w = depth.get_width(), h = depth.get_height();
+	auto out = source.allocate_video_frame(_rgb_profile, depth, 3, w, h, w * 3, RS2_EXTENSION_VIDEO_FRAME)
+		.as<rs2::video_frame>();
+	colorize((const uint16_t*)depth.get_data(), w, h, depth.get_stride_in_bytes(),
+		(uint8_t*)out.get_data(), out.get_stride_in_bytes());
+	return out;
+}
+
+long long lut_colorizer::compare(const rs2::video_frame& a, const rs2::video_frame& b)
+{
+	if (!a || !b || a.get_width() != b.get_width() || a.get_height() != b.get_height() ||
+		a.get_bytes_per_pixel() != 3 || b.get_bytes_per_pixel() != 3)
+		return -1;
+
+	long long diff = 0;
+	const int w = a.get_width();
+	for (int y = 0; y < a.get_height(); y++)
+	{
+		auto pa = (const uint8_t*)a.get_data() + (size_t)y * a.get_stride_in_bytes();
+		auto pb = (const uint8_t*)b.get_data() + (size_t)y * b.get_stride_in_bytes();
+		if (!memcmp(pa, pb, (size_t)w * 3)) continue;
+		for (int x = 0; x < w * 3; x += 3)
+			if (pa[x] != pb[x] || pa[x + 1] != pb[x + 1] || pa[x + 2] != pb[x + 2]) diff++;
+	}
+	return diff;
+}
@@ -0,0 +1,51 @@
+// lut_colorizer.h : Z16 -> RGB8 lookup-table colorizer for a fixed range
+//
+// The viewer only uses one mapping : colour scheme 2 (white to black),
+// histogram equalisation off, fixed cz_minZ / cz_maxZ. This colorizer
+// precomputes the RGB value of every Z16 code once (rebuilt when the depth
+// units change) with the same float arithmetic as rs2::colorizer, then maps a
+// frame with an AVX2 gather kernel, an SSSE3 kernel or a scalar loop.
+//
+// depth_pipeline checks the output against rs2::colorizer and falls back to it
+// on any difference, so a librealsense release with other rounding can never
+// change what is rendered or saved.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <cstdint>
+#include <vector>
+
+class lut_colorizer
+{
+public:
+	enum kernel_type { kernel_scalar, kernel_ssse3, kernel_avx2 };
+
+	lut_colorizer(float min_z, float max_z);
+
+	// (re)build the table for these depth units, no-op when unchanged
+	void set_depth_units(float depth_units);
+
+	// raw kernel : writes straight into any RGB8 buffer (texture upload, capture buffer)
+	void colorize(const uint16_t* depth, int width, int height, int depth_stride_bytes,
+		uint8_t* rgb, int rgb_stride_bytes) const;
+
+	// processing-block path : allocates an RGB8 frame on the depth stream from source
+	rs2::frame process(const rs2::depth_frame& depth, const rs2::frame_source& source);
+
+	kernel_type kernel() const { return _kernel; }
+	void force_kernel(kernel_type k);		// benchmarks / tests, clamped to what the CPU supports
+	static const char* kernel_name(kernel_type k);
+
+	// number of pixels that differ between two RGB8 frames of the same size, -1 if not comparable
+	static long long compare(const rs2::video_frame& a, const rs2::video_frame& b);
+
+private:
+	float _min_z, _max_z;
+	float _depth_units = 0;
+	kernel_type _kernel, _best_kernel;
+	std::vector<uint32_t> _lut;				// 65536 entries, 0x00BBGGRR
+	rs2::stream_profile _rgb_profile;		// RGB8 clone of the last depth profile
+	int _rgb_profile_source = -1;			// unique id of that depth profile
+};
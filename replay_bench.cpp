@@ -0,0 +1,818 @@
+// replay_bench.cpp : headless replay and benchmark harness
+//
+// Runs the same camera_unit / depth_pipeline / capture_rig / frame_recorder path
+// as the viewer, without a camera or an OpenGL window : a rig of one replay
+// unit whose feeding thread takes its framesets from a .bag recording or from a
+// synthetic Z16 + RGB8 source fed through rs2::software_device, while this
+// thread triggers the captures like the viewer's key thread. Reports per-stage latency (p50 / p99), throughput and
+// heap allocations per frame.
+//
+//   replay_bench [--bag <file.bag>] [--frames N] [--size W H]
+//                [--capture-every N] [--record <dir>] [--warmup N]
+//                [--colorizer lut|rs2|scalar|ssse3] [--verify-colorizer]
+//                [--roi X Y W H] [--band MIN MAX] [--holes-fill N]
+//                [--spatial exact|tiled|rs2] [--threads N] [--tile W H HALO] [--verify-spatial]
+//                [--pipeline QUEUE] [--pre-trigger K] [--post-trigger K] [--ring-frames N]
+//                [--telemetry <file.csv | file.rstel>] [--control <socket path>]
+//                [--average N] [--verify-average]
+//   replay_bench --spatial-scaling [--size W H] [--frames N] [--holes-fill N]
+//   replay_bench --codec-bench [--bag <file.bag>] [--size W H] [--frames N]
+//
+// --verify-spatial runs rs2::spatial_filter next to the tiled filter on every
+// frame and reports both latencies. --spatial-scaling times the tiled filter
+// alone on a synthetic disparity image for 1, 2, 4 .. hardware threads.
+// --pipeline 0 runs align / filter / colorize on the feeding thread, the default
+// (2) runs them as three pipelined stages like the viewer.
+// --pre-trigger / --post-trigger make every capture save frames T-K .. T+K
+// around its trigger through camera_rig::matched_window, from the unit's ring;
+// the run fails if a window not cut by the start or end of the stream is
+// missing any of them.
+// --telemetry logs the metadata of every snapshot through frame_telemetry (binary
+// for a .rstel name); the run fails if a record is dropped.
+// --control serves a control_socket with the viewer's rig_trigger::command and
+// sends every capture through it as a client (like a PLC gateway would); the
+// capture latency is then the round trip up to the written files. After the
+// first capture it also sends "capture 3", a "capture N" one frame over what
+// the ring holds, "average 5" and an unknown command. The run fails on an ERR
+// reply where an OK is due, and the other way round.
+// --average averages the raw depth of N frames from the end of the warm-up on
+// through the unit's depth_average while the pipeline runs, and captures the
+// result; the run fails if the average does not complete. --verify-average runs a
+// scalar depth_average on the same frames (the source waits for both, so neither
+// skips one) and fails if any output pixel differs from the SSE2 kernel.
+// --codec-bench encodes the depth frames of the source (the real ones of a .bag,
+// or the synthetic scene) with RVL, cv::imencode (what cv::imwrite does before
+// the file write) and stb, and reports MB/s of Z16 input and the compression
+// ratio. The run fails if an RVL frame does not decode to the same samples.
+//
+// Captures are written under output_image/ like the viewer does, the
+// directory must exist.
+
+#include <librealsense2/rs.hpp>
+#include <librealsense2/hpp/rs_internal.hpp>	// software_device
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "camera_rig.h"
+#include "rig_trigger.h"
+#include "depth_pipeline.h"
+#include "capture_writer.h"
+#include "depth_codec.h"
+#include "frame_recorder.h"
+#include "frame_telemetry.h"
+#include "control_socket.h"
+#include "depth_average.h"
+#include "latency_histogram.h"
+
+#include <opencv2/opencv.hpp>
+#include "../stb_image_write_109.h"			// declarations, the implementation is in capture_writer.cpp
+
+// same colorizer range as the viewer
+const float cz_minZ = 0.2f;
+const float cz_maxZ = 0.4f;
+
+// Heap allocation counter : every operator new in the process (librealsense included)
+static std::atomic<unsigned long long> g_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+	g_allocations++;
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+struct bench_options
+{
+	std::string bag;					// empty = synthetic source
+	int frames = 300;
+	int warmup = 30;					// frames excluded from the statistics (temporal filter settle)
+	int width = 1280, height = 720;
+	int capture_every = 0;				// 0 = no captures
+	std::string record_dir;				// empty = no recording
+	std::string colorizer = "lut";		// lut (best kernel), scalar, ssse3, rs2
+	bool verify_colorizer = false;		// compare with rs2::colorizer on every frame
+	int roi[4] = { 0, 0, 0, 0 };		// work area, 0 x 0 = whole frame
+	float band[2] = { 0, 0 };			// depth band in meters, min >= max = none
+	int holes_fill = 2;
+	std::string spatial = "exact";		// exact / tiled (tiled_spatial_filter), rs2 (rs2::spatial_filter)
+	unsigned threads = 0;				// spatial filter pool, 0 = hardware threads
+	int tile[3] = { 0, 0, 0 };			// tile width, height, halo; 0 = default
+	bool verify_spatial = false;
+	bool spatial_scaling = false;
+	bool codec_bench = false;
+	int pipeline = 2;					// stage queue size, 0 = not pipelined
+	unsigned pre_trigger = 0, post_trigger = 0;	// capture T-K .. T+K from a frame_ring
+	int ring_frames = 16;
+	std::string telemetry;				// empty = no metadata log
+	std::string control;				// empty = captures called directly
+	unsigned average = 0;				// frames of the depth average, 0 = none
+	bool verify_average = false;
+};
+
+static void print_histogram(const char* name, const latency_histogram& h)
+{
+	std::cout << std::left << std::setw(12) << name << std::right
+		<< " n " << std::setw(6) << h.count()
+		<< "  p50 " << std::setw(7) << h.percentile_us(0.50) << " us"
+		<< "  p99 " << std::setw(7) << h.percentile_us(0.99) << " us"
+		<< "  max " << std::setw(7) << h.max_us() << " us"
+		<< "  mean " << std::fixed << std::setprecision(1) << std::setw(8) << h.mean_us() << " us" << std::endl;
+}
+
+// pixels that differ between two frames of the same size and pixel size, -1 if not comparable
+static long long frame_diff(const rs2::video_frame& a, const rs2::video_frame& b)
+{
+	if (!a || !b || a.get_width() != b.get_width() || a.get_height() != b.get_height()
+		|| a.get_bytes_per_pixel() != b.get_bytes_per_pixel()) return -1;
+	const int bpp = a.get_bytes_per_pixel();
+	long long diff = 0;
+	for (int y = 0; y < a.get_height(); y++)
+	{
+		auto pa = (const uint8_t*)a.get_data() + (size_t)y * a.get_stride_in_bytes();
+		auto pb = (const uint8_t*)b.get_data() + (size_t)y * b.get_stride_in_bytes();
+		for (int x = 0; x < a.get_width(); x++)
+			if (memcmp(pa + (size_t)x * bpp, pb + (size_t)x * bpp, (size_t)bpp)) diff++;
+	}
+	return diff;
+}
+
+// Synthetic D400-like scene : tilted plane between cz_minZ and cz_maxZ, a moving
+// box, sensor noise and a few holes. A small set of frames is generated up front
+// and cycled, so generation cost stays out of the measurement.
+class synthetic_source
+{
+public:
+	synthetic_source(int width, int height, int variants = 8)
+		: _w(width), _h(height)
+	{
+		const float depth_units = 0.001f;
+		rs2_intrinsics intr = {};
+		intr.width = width;
+		intr.height = height;
+		intr.ppx = width / 2.f;
+		intr.ppy = height / 2.f;
+		intr.fx = intr.fy = width * 0.7f;
+		intr.model = RS2_DISTORTION_BROWN_CONRADY;
+
+		_depth_sensor.reset(new rs2::software_sensor(_dev.add_sensor("Depth")));
+		_color_sensor.reset(new rs2::software_sensor(_dev.add_sensor("Color")));
+
+		rs2_video_stream ds = {};
+		ds.type = RS2_STREAM_DEPTH; ds.index = 0; ds.uid = 0;
+		ds.width = width; ds.height = height; ds.fps = 30; ds.bpp = 2;
+		ds.fmt = RS2_FORMAT_Z16; ds.intrinsics = intr;
+		_depth_stream = _depth_sensor->add_video_stream(ds);
+		_depth_sensor->add_read_only_option(RS2_OPTION_DEPTH_UNITS, depth_units);
+		_depth_sensor->add_read_only_option(RS2_OPTION_STEREO_BASELINE, 50.f);	// mm, needed by disparity_transform
+
+		rs2_video_stream cs = {};
+		cs.type = RS2_STREAM_COLOR; cs.index = 0; cs.uid = 1;
+		cs.width = width; cs.height = height; cs.fps = 30; cs.bpp = 3;
+		cs.fmt = RS2_FORMAT_RGB8; cs.intrinsics = intr;
+		_color_stream = _color_sensor->add_video_stream(cs, true);
+
+		_depth_stream.register_extrinsics_to(_color_stream, { { 1,0,0, 0,1,0, 0,0,1 }, { 0,0,0 } });
+		_dev.create_matcher(RS2_MATCHER_DLR_C);
+
+		// pixel buffers
+		unsigned int seed = 12345;
+		auto noise = [&seed]() { seed = seed * 1103515245u + 12345u; return (int)((seed >> 16) % 7) - 3; };
+		for (int v = 0; v < variants; v++)
+		{
+			std::vector<uint16_t> depth((size_t)width * height);
+			std::vector<uint8_t> color((size_t)width * height * 3);
+			int bx = (v * width / variants) % (width - width / 5);
+			for (int y = 0; y < height; y++)
+			{
+				for (int x = 0; x < width; x++)
+				{
+					float z = cz_minZ + (cz_maxZ - cz_minZ) * (0.25f + 0.5f * y / height);
+					bool in_box = x >= bx && x < bx + width / 5 && y > height / 3 && y < 2 * height / 3;
+					if (in_box) z -= 0.03f;
+					uint16_t d = (uint16_t)(z / depth_units) + noise();
+					if ((x * 7 + y * 13 + v) % 97 == 0) d = 0;		// holes
+					depth[(size_t)y * width + x] = d;
+					uint8_t* c = &color[((size_t)y * width + x) * 3];
+					c[0] = (uint8_t)(x * 255 / width);
+					c[1] = (uint8_t)(y * 255 / height);
+					c[2] = in_box ? 200 : 60;
+				}
+			}
+			_depth.push_back(std::move(depth));
+			_color.push_back(std::move(color));
+		}
+
+		_depth_sensor->open(_depth_stream);
+		_color_sensor->open(_color_stream);
+		_depth_sensor->start(_sync);
+		_color_sensor->start(_sync);
+	}
+
+	~synthetic_source()
+	{
+		_depth_sensor->stop();
+		_color_sensor->stop();
+		_depth_sensor->close();
+		_color_sensor->close();
+	}
+
+	// next synced depth + colour frameset
+	bool next(rs2::frameset& fs)
+	{
+		size_t v = (size_t)(_number % _depth.size());
+		double ts = _number * 1000.0 / 30;
+		_number++;
+
+		rs2::software_video_frame df = {};
+		df.pixels = _depth[v].data();
+		df.deleter = [](void*) {};			// buffers are owned by the source
+		df.stride = _w * 2;
+		df.bpp = 2;
+		df.timestamp = ts;
+		df.domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK;
+		df.frame_number = (int)_number;
+		df.profile = _depth_stream;
+		_depth_sensor->on_video_frame(df);
+
+		rs2::software_video_frame cf = df;
+		cf.pixels = _color[v].data();
+		cf.stride = _w * 3;
+		cf.bpp = 3;
+		cf.profile = _color_stream;
+		_color_sensor->on_video_frame(cf);
+
+		for (int tries = 0; tries < 10; tries++)
+		{
+			if (_sync.try_wait_for_frames(&fs, 1000) && fs.size() == 2) return true;
+		}
+		return false;
+	}
+
+private:
+	int _w, _h;
+	unsigned long long _number = 0;
+	rs2::software_device _dev;
+	std::unique_ptr<rs2::software_sensor> _depth_sensor, _color_sensor;
+	rs2::stream_profile _depth_stream, _color_stream;
+	rs2::syncer _sync;
+	std::vector<std::vector<uint16_t>> _depth;
+	std::vector<std::vector<uint8_t>> _color;
+};
+
+// .bag playback, as fast as the pipeline consumes it
+class bag_source
+{
+public:
+	explicit bag_source(const std::string& file)
+	{
+		rs2::config cfg;
+		cfg.enable_device_from_file(file, false);		// no repeat, stop at the end
+		auto profile = _pipe.start(cfg);
+		auto playback = profile.get_device().as<rs2::playback>();
+		playback.set_real_time(false);
+		depth_scale = profile.get_device().first<rs2::depth_sensor>().get_depth_scale();
+	}
+	~bag_source() { _pipe.stop(); }
+
+	bool next(rs2::frameset& fs) { return _pipe.try_wait_for_frames(&fs, 1000); }
+
+	float depth_scale = 0.001f;
+
+private:
+	rs2::pipeline _pipe;
+};
+
+static bench_options parse(int argc, char* argv[])
+{
+	bench_options o;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		bool more = i + 1 < argc;
+		if (arg == "--bag" && more) o.bag = argv[++i];
+		else if (arg == "--frames" && more) o.frames = std::max(1, atoi(argv[++i]));
+		else if (arg == "--warmup" && more) o.warmup = std::max(0, atoi(argv[++i]));
+		else if (arg == "--capture-every" && more) o.capture_every = std::max(0, atoi(argv[++i]));
+		else if (arg == "--record" && more) o.record_dir = argv[++i];
+		else if (arg == "--colorizer" && more) o.colorizer = argv[++i];
+		else if (arg == "--verify-colorizer") o.verify_colorizer = true;
+		else if (arg == "--roi" && i + 4 < argc) for (int k = 0; k < 4; k++) o.roi[k] = atoi(argv[++i]);
+		else if (arg == "--band" && i + 2 < argc) for (int k = 0; k < 2; k++) o.band[k] = (float)atof(argv[++i]);
+		else if (arg == "--holes-fill" && more) o.holes_fill = std::min(5, std::max(0, atoi(argv[++i])));
+		else if (arg == "--spatial" && more) o.spatial = argv[++i];
+		else if (arg == "--threads" && more) o.threads = (unsigned)std::max(0, atoi(argv[++i]));
+		else if (arg == "--tile" && i + 3 < argc) for (int k = 0; k < 3; k++) o.tile[k] = atoi(argv[++i]);
+		else if (arg == "--verify-spatial") o.verify_spatial = true;
+		else if (arg == "--spatial-scaling") o.spatial_scaling = true;
+		else if (arg == "--codec-bench") o.codec_bench = true;
+		else if (arg == "--pipeline" && more) o.pipeline = std::max(0, atoi(argv[++i]));
+		else if (arg == "--pre-trigger" && more) o.pre_trigger = (unsigned)std::max(0, atoi(argv[++i]));
+		else if (arg == "--post-trigger" && more) o.post_trigger = (unsigned)std::max(0, atoi(argv[++i]));
+		else if (arg == "--ring-frames" && more) o.ring_frames = std::max(1, atoi(argv[++i]));
+		else if (arg == "--telemetry" && more) o.telemetry = argv[++i];
+		else if (arg == "--control" && more) o.control = argv[++i];
+		else if (arg == "--average" && more) o.average = (unsigned)std::min(65535, std::max(0, atoi(argv[++i])));
+		else if (arg == "--verify-average") o.verify_average = true;
+		else if (arg == "--size" && i + 2 < argc)
+		{
+			o.width = atoi(argv[++i]);
+			o.height = atoi(argv[++i]);
+		}
+		else
+		{
+			std::cerr << "unknown argument : " << arg << std::endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+	return o;
+}
+
+template<class Source>
+static int run(Source& source, const bench_options& opt, float depth_scale)
+{
+	// one replay unit : the viewer's feeding thread, ring, averager and trigger path on the source's frames.
+	// The ring is the trigger window (or only the newest snapshot for matched()), bounded by count only :
+	// the source's sensor pools cannot grow. --control needs the ring for "capture N"
+	const bool windows = opt.pre_trigger || opt.post_trigger;
+	rig_options ropt;
+	ropt.width = opt.width;
+	ropt.height = opt.height;
+	ropt.ring_frames = windows || !opt.control.empty() ?
+		std::max((size_t)opt.ring_frames, (size_t)(opt.pre_trigger + opt.post_trigger + 1)) : 1;
+	ropt.ring_bytes = 0;
+	std::vector<std::unique_ptr<camera_unit>> units;
+	units.emplace_back(new camera_unit(0, "replay", ropt, cz_minZ, cz_maxZ));
+	camera_rig rig(std::move(units), ropt);
+	camera_unit& unit = rig[0];
+
+	depth_pipeline& processing = unit.processing();
+	processing.use_lut_colorizer(opt.colorizer != "rs2");
+	if (opt.colorizer == "scalar") processing.lut().force_kernel(lut_colorizer::kernel_scalar);
+	if (opt.colorizer == "ssse3") processing.lut().force_kernel(lut_colorizer::kernel_ssse3);
+	processing.verify_colorizer(opt.verify_colorizer ? -1 : 0);
+	processing.roi().set_rect(opt.roi[0], opt.roi[1], opt.roi[2], opt.roi[3]);
+	processing.roi().set_band(opt.band[0], opt.band[1]);
+	processing.set_holes_fill(opt.holes_fill);
+	processing.use_tiled_spatial(opt.spatial != "rs2");
+	processing.spatial().set_mode(opt.spatial == "tiled" ? tiled_spatial_filter::mode_tiled : tiled_spatial_filter::mode_exact);
+	if (opt.threads) processing.spatial().set_threads(opt.threads);
+	if (opt.tile[0]) processing.spatial().set_tile(opt.tile[0], opt.tile[1], opt.tile[2]);
+	processing.verify_spatial(opt.verify_spatial ? -1 : 0);
+	processing.set_pipelined((size_t)opt.pipeline);
+
+	// the viewer's triggers, writer queue and control commands
+	trigger_options topt;
+	topt.pre_trigger = opt.pre_trigger;
+	topt.post_trigger = opt.post_trigger;
+	std::atomic<unsigned long long> saved{ 0 }, failed{ 0 };
+	capture_writer writer(rig_trigger::writer_capacity(rig, topt, 16), 2, [&](const capture_job&, bool ok) { if (ok) saved++; else failed++; });
+	rig_trigger triggers(rig, writer, topt);
+
+	std::unique_ptr<frame_recorder> recorder;
+	if (!opt.record_dir.empty())
+	{
+		recorder_config rc;
+		rc.directory = opt.record_dir;
+		rc.depth_scale = depth_scale;
+		recorder.reset(new frame_recorder(rc));
+	}
+
+	std::unique_ptr<frame_telemetry> telemetry;
+	if (!opt.telemetry.empty())
+	{
+		telemetry_config tc;
+		tc.filename = opt.telemetry;
+		tc.binary = opt.telemetry.size() > 6 && opt.telemetry.compare(opt.telemetry.size() - 6, 6, ".rstel") == 0;
+		tc.ring_records = 2 * (size_t)(opt.warmup + opt.frames) + 16;	// the whole run, so no record can drop
+		telemetry.reset(new frame_telemetry(tc));
+	}
+
+	// depth average from the end of the warm-up on, by the unit's averager; --verify-average offers
+	// the same frames to a scalar one, and the source waits for both so neither skips a frame
+	std::unique_ptr<depth_average> reference;
+	depth_average_result average_result, reference_result;
+	if (opt.average && opt.verify_average)
+	{
+		reference.reset(new depth_average());
+		reference->force_kernel(depth_average::kernel_scalar);
+	}
+
+	// the unit's feeding thread pulls the source : all it does with a frameset until the next
+	// pull (camera stats, average offer, invoke) is timed as "invoke"
+	latency_histogram invoke_latency, capture_latency;
+	std::atomic<int> fed{ 0 };
+	std::atomic<bool> ended{ false };
+	std::atomic<unsigned long long> first_number{ 0 }, last_number{ 0 };
+	unsigned long long alloc_start = 0;		// feeding thread, read after rig.stop()
+	auto wall_start = std::chrono::steady_clock::now();
+	auto handed_over = wall_start;
+	auto feed = [&](rs2::frameset& fs) {
+		const int n = fed;
+		if (n > opt.warmup && n <= opt.warmup + opt.frames)
+			invoke_latency.record_us((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - handed_over).count());
+		if (ended || n >= opt.warmup + opt.frames)
+		{
+			ended = true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			return false;
+		}
+		if (reference)
+			while (unit.average().queued() || reference->queued()) std::this_thread::yield();
+		if (!source.next(fs))				// end of recording
+		{
+			ended = true;
+			return false;
+		}
+		if (n == opt.warmup)
+		{
+			processing.enable_timing(true);
+			alloc_start = g_allocations;
+			wall_start = std::chrono::steady_clock::now();
+			if (opt.average) unit.average().start(opt.average, 0, [&](const depth_average_result& r) { average_result = r; });
+			if (reference) reference->start(opt.average, 0, [&](const depth_average_result& r) { reference_result = r; });
+		}
+		if (reference) reference->offer(fs.get_depth_frame());
+		const unsigned long long number = fs.get_depth_frame().get_frame_number();
+		if (!first_number) first_number = number;
+		last_number = number;
+		handed_over = std::chrono::steady_clock::now();
+		fed = n + 1;
+		return true;
+	};
+
+	const auto timestamper = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::system_clock::now().time_since_epoch());
+
+	// control socket : replies checked for their last line, OK or ERR as expected
+	std::unique_ptr<control_socket> control;
+	unsigned long long control_errors = 0;
+	auto expect = [&](const std::string& command, const char* status) {
+		std::string reply = control_request(opt.control, command);
+		size_t last = reply.rfind('\n', reply.size() - 2);
+		if (reply.compare(last == std::string::npos ? 0 : last + 1, strlen(status), status) != 0)
+		{
+			std::cerr << "control : " << command << " : " << reply;
+			control_errors++;
+		}
+		return reply;
+	};
+	if (!opt.control.empty())
+	{
+		control.reset(new control_socket(opt.control, [&](const std::string& line) { return triggers.command(line); }));
+		expect("capture x", "ERR");			// a malformed command must be refused, not run
+		expect("t", "OK");
+	}
+
+	// T-K .. T+K windows by frame number of the first camera, checked once the stream has ended
+	std::vector<std::vector<unsigned long long>> window_numbers;
+
+	unit.start(feed, [&](size_t, rs2::frameset, const frame_snapshot& snap) {
+		if (recorder) recorder->push(snap);
+		if (telemetry) telemetry->log(snap);
+	});
+
+	// this thread is the viewer's trigger thread : a capture once the frame it follows is handed over
+	for (int k = 0; opt.capture_every; k++)
+	{
+		const int processed = opt.warmup + k * opt.capture_every;
+		if (processed >= opt.warmup + opt.frames) break;
+		while (fed <= processed && !ended) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		if (fed <= processed) break;
+		if (windows && processed + (int)opt.post_trigger >= opt.warmup + opt.frames) break;	// T+K past the end
+
+		const char key = (processed / opt.capture_every) % 2 ? 'd' : '1';
+		auto c0 = std::chrono::steady_clock::now();
+		if (control)
+			expect(std::string(1, key), "OK");
+		else
+		{
+			auto sets = triggers.capture(windows ? 'd' : key, 1);
+			if (windows)
+			{
+				window_numbers.emplace_back();
+				for (auto& set : sets) window_numbers.back().push_back(set[0].frame_number);
+			}
+		}
+		capture_latency.record_us((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - c0).count());
+
+		if (control && k == 0)
+		{
+			// every set of "capture 3" acknowledged with its frame; one frame more than the ring is refused
+			std::string reply = expect("capture 3", "OK");
+			std::istringstream lines(reply);
+			size_t frames = 0;
+			for (std::string line; std::getline(lines, line); ) frames += line.compare(0, 6, "frame ") == 0;
+			if (frames != 3)
+			{
+				std::cerr << "control : capture 3 acknowledged " << frames << " frames" << std::endl;
+				control_errors++;
+			}
+			expect("capture " + std::to_string(triggers.max_count() + 1), "ERR");
+			expect("average 5", "OK");
+			expect("bogus", "ERR");
+		}
+	}
+	while (!ended) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	rig.stop();								// frames still in the stages count for the wall time
+	if (reference) reference->stop();		// the unit's averager is stopped by rig.stop()
+	if (average_result) capture_average(average_result, timestamper, writer);
+	auto wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+	const int processed = fed;
+	int measured_frames = std::max(0, processed - opt.warmup);
+	unsigned long long allocations = g_allocations - alloc_start;
+
+	// a window must be T-K .. T+K without a hole; one cut by the start or the end of the stream is not counted
+	unsigned long long window_sets = 0, window_frames = 0, window_expected = 0;
+	for (auto& numbers : window_numbers)
+	{
+		if (numbers.empty() || numbers.front() == first_number || numbers.back() == last_number) continue;
+		window_sets++;
+		window_expected += opt.pre_trigger + opt.post_trigger + 1;
+		for (size_t i = 0; i < numbers.size(); i++)
+			if (numbers[i] == numbers.front() + i) window_frames++;
+	}
+
+	control.reset();
+	writer.flush();
+	recorder.reset();
+	if (telemetry) telemetry->stop();		// every record written, stats are final
+
+	std::cout << "colorizer   " << (processing.lut_colorizer_active() ?
+		lut_colorizer::kernel_name(processing.lut().kernel()) : "rs2::colorizer");
+	if (opt.verify_colorizer) std::cout << ", " << processing.colorizer_mismatches() << " pixels differ from rs2::colorizer";
+	std::cout << std::endl;
+	std::cout << "spatial     ";
+	if (processing.tiled_spatial_active())
+		std::cout << tiled_spatial_filter::mode_name(processing.spatial().mode()) << ", "
+			<< processing.spatial().threads() << " threads";
+	else
+		std::cout << "rs2::spatial_filter";
+	if (opt.verify_spatial) std::cout << ", " << processing.spatial_mismatches() << " pixels differ from rs2::spatial_filter";
+	std::cout << std::endl;
+	std::cout << "frames      " << measured_frames << " measured (" << opt.warmup << " warm-up)" << std::endl;
+	print_histogram("align", processing.align_latency);
+	print_histogram("filter", processing.filter_latency);
+	if (processing.tiled_spatial_active()) print_histogram("  spatial", processing.spatial_latency);
+	if (opt.verify_spatial) print_histogram("  rs2 spat", processing.spatial_reference_latency);
+	print_histogram("colorize", processing.colorize_latency);
+	print_histogram("total", processing.total_latency);
+	print_histogram("invoke", invoke_latency);
+	if (processing.pipelined()) processing.print_stages(std::cout);
+	if (opt.capture_every)
+	{
+		print_histogram("capture", capture_latency);
+		std::cout << "captures    saved " << saved << ", failed " << failed << ", rejected " << writer.rejected() << std::endl;
+	}
+	if (!opt.control.empty())				// the server is already stopped
+		std::cout << "control     " << opt.control << " : " << (opt.capture_every ? "captures round trip" : "no captures")
+			<< ", " << control_errors << " errors" << std::endl;
+	if (telemetry)
+	{
+		std::cout << "telemetry   " << opt.telemetry << std::endl;
+		telemetry->print(std::cout);
+	}
+	long long average_diff = 0;
+	if (opt.average)
+	{
+		std::cout << "average     " << depth_average::kernel_name(unit.average().kernel()) << ", ";
+		if (!average_result) std::cout << "not complete";
+		else
+			std::cout << average_result.frames << " frames #" << average_result.first_frame << " .. #" << average_result.last_frame
+				<< ", fill " << (int)(average_result.fill * 100) << "%, deviation " << average_result.mean_deviation
+				<< " units, skipped " << average_result.skipped;
+		if (reference)
+		{
+			average_diff = -1;
+			if (average_result && reference_result)
+			{
+				average_diff = 0;
+				const rs2::frame pairs[][2] = { { average_result.depth, reference_result.depth }, { average_result.meters, reference_result.meters },
+					{ average_result.deviation, reference_result.deviation }, { average_result.samples, reference_result.samples } };
+				for (auto& pair : pairs)
+				{
+					long long d = frame_diff(pair[0].as<rs2::video_frame>(), pair[1].as<rs2::video_frame>());
+					average_diff = d < 0 || average_diff < 0 ? -1 : average_diff + d;
+				}
+			}
+			std::cout << ", " << average_diff << " pixels differ from the scalar kernel";
+		}
+		std::cout << std::endl;
+		print_histogram("avg add", unit.average().add_latency);
+	}
+	if (windows)
+		std::cout << "ring        " << unit.ring().max_frames() << " frames, T-" << opt.pre_trigger << " .. T+" << opt.post_trigger
+			<< " : " << window_sets << " windows, " << window_frames << " / " << window_expected << " frames" << std::endl;
+	std::cout << std::fixed << std::setprecision(1)
+		<< "throughput  " << (wall > 0 ? measured_frames / wall : 0) << " fps" << std::endl
+		<< "allocations " << (measured_frames ? (double)allocations / measured_frames : 0) << " per frame" << std::endl;
+
+	if (!measured_frames)
+	{
+		std::cerr << "no frames processed" << std::endl;
+		return EXIT_FAILURE;
+	}
+	bool spatial_failed = opt.verify_spatial && opt.spatial == "exact" && processing.spatial_mismatches();
+	bool window_failed = windows && window_frames != window_expected;
+	bool average_failed = opt.average && (!average_result || average_diff);
+	return (failed || processing.colorizer_mismatches() || spatial_failed || window_failed || (telemetry && telemetry->dropped()) || control_errors || average_failed) ?
+		EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// tiled_spatial_filter alone on a synthetic disparity image : serial reference, then
+// both modes for 1, 2, 4 .. hardware threads. mode_exact must match the reference.
+static int spatial_scaling(const bench_options& opt)
+{
+	const int w = opt.width, h = opt.height;
+	std::vector<float> disparity((size_t)w * h), out((size_t)w * h), reference;
+	unsigned int seed = 12345;
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			float d = 3000.f + 0.5f * y + (seed >> 16) % 40 + ((x / 200) % 2 ? 300.f : 0.f);	// steps = edges
+			if ((x * 7 + y * 13) % 97 == 0) d = 0;		// holes
+			disparity[(size_t)y * w + x] = d;
+		}
+	}
+
+	tiled_spatial_filter filter(1);
+	filter.set_options(0.5f, 20.f, 2, opt.holes_fill);	// rs2::spatial_filter defaults
+	if (opt.tile[0]) filter.set_tile(opt.tile[0], opt.tile[1], opt.tile[2]);
+	const int runs = std::max(1, std::min(opt.frames, 100));
+
+	auto time_ms = [&](std::function<void()> fn) {
+		fn();									// warm up caches and pool threads
+		auto t0 = std::chrono::steady_clock::now();
+		for (int i = 0; i < runs; i++) fn();
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() / runs;
+	};
+
+	double serial = time_ms([&]() {
+		reference = disparity;
+		filter.filter_serial(reference.data(), w, h, w * (int)sizeof(float));
+	});
+	std::cout << std::fixed << std::setprecision(2)
+		<< "spatial     serial " << serial << " ms (" << w << "x" << h << ", " << runs << " runs)" << std::endl;
+
+	bool exact_ok = true;
+	unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned threads = 1; ; threads = std::min(threads * 2, hw))
+	{
+		filter.set_threads(threads);
+		filter.set_mode(tiled_spatial_filter::mode_exact);
+		double exact = time_ms([&]() { filter.filter(disparity.data(), w * 4, out.data(), w * 4, w, h); });
+		bool same = out == reference;
+		exact_ok = exact_ok && same;
+		filter.set_mode(tiled_spatial_filter::mode_tiled);
+		double tiled = time_ms([&]() { filter.filter(disparity.data(), w * 4, out.data(), w * 4, w, h); });
+		long long diff = 0;
+		for (size_t i = 0; i < out.size(); i++) diff += memcmp(&out[i], &reference[i], sizeof(float)) != 0;
+
+		std::cout << "threads " << std::setw(3) << threads
+			<< "  exact " << std::setw(7) << exact << " ms" << (same ? "" : " (DIFFERS)")
+			<< "  tiled " << std::setw(7) << tiled << " ms (" << diff << " px differ)" << std::endl;
+		if (threads == hw) break;
+	}
+	return exact_ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// RVL against the PNG encoders the captures used, on the depth frames of the source
+template<class Source>
+static int codec_bench(Source& source, const bench_options& opt)
+{
+	std::vector<std::vector<uint16_t>> frames;
+	int w = 0, h = 0;
+	for (int i = 0; i < std::min(opt.frames, 60); i++)
+	{
+		rs2::frameset fs;
+		if (!source.next(fs)) break;
+		auto depth = fs.get_depth_frame();
+		w = depth.get_width();
+		h = depth.get_height();
+		std::vector<uint16_t> packed((size_t)w * h);
+		for (int y = 0; y < h; y++)
+			memcpy(&packed[(size_t)y * w], (const uint8_t*)depth.get_data() + (size_t)y * depth.get_stride_in_bytes(), (size_t)w * 2);
+		frames.push_back(std::move(packed));
+	}
+	if (frames.empty())
+	{
+		std::cerr << "no frames" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const size_t pixels = (size_t)w * h;
+	const double raw_mb = frames.size() * pixels * 2 / 1e6;
+	std::vector<uint8_t> encoded(rvl_max_bytes(pixels));
+	std::vector<uint16_t> decoded(pixels);
+	std::vector<unsigned char> png;
+
+	// seconds for all the frames, after one untimed pass; bytes of the last pass
+	auto time_s = [&](std::function<size_t(const std::vector<uint16_t>&)> fn, size_t& bytes) {
+		for (auto& f : frames) fn(f);
+		bytes = 0;
+		auto t0 = std::chrono::steady_clock::now();
+		for (auto& f : frames) bytes += fn(f);
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	};
+	auto report = [&](const char* name, double seconds, size_t bytes) {
+		std::cout << std::left << std::setw(22) << name << std::right << std::fixed << std::setprecision(1)
+			<< " enc " << std::setw(8) << raw_mb / seconds << " MB/s"
+			<< std::setprecision(2) << "  ratio " << std::setw(5) << raw_mb * 1e6 / bytes << " : 1"
+			<< std::setprecision(2) << "  " << seconds * 1e3 / frames.size() << " ms/frame" << std::endl;
+	};
+	std::cout << "codec       " << frames.size() << " frames " << w << "x" << h << ", " << raw_mb << " MB of Z16" << std::endl;
+
+	size_t rvl_bytes = 0;
+	double rvl_s = time_s([&](const std::vector<uint16_t>& f) { return rvl_encode(f.data(), pixels, encoded.data()); }, rvl_bytes);
+	report("rvl", rvl_s, rvl_bytes);
+
+	// decode : every frame encoded to its own buffer first, then timed alone
+	std::vector<std::vector<uint8_t>> streams;
+	for (auto& f : frames)
+	{
+		size_t bytes = rvl_encode(f.data(), pixels, encoded.data());
+		streams.emplace_back(encoded.begin(), encoded.begin() + bytes);
+	}
+	size_t mismatches = 0;
+	double decode_s = 0;
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		bool ok = rvl_decode(streams[i].data(), streams[i].size(), decoded.data(), pixels);
+		decode_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		if (!ok || decoded != frames[i]) mismatches++;
+	}
+	std::cout << std::left << std::setw(22) << "rvl" << std::right << " dec " << std::setw(8) << std::setprecision(1)
+		<< raw_mb / decode_s << " MB/s  " << mismatches << " frames differ" << std::endl;
+
+	size_t cv_bytes = 0;
+	double cv_s = time_s([&](const std::vector<uint16_t>& f) {
+		cv::Mat depth16(h, w, CV_16UC1, (void*)f.data());
+		cv::imencode(".png", depth16, png);
+		return png.size();
+	}, cv_bytes);
+	report("cv::imencode png16", cv_s, cv_bytes);
+
+	// stb writes 8 bit channels only : the Z16 bytes as a 2 channel image, same input size
+	size_t stb_bytes = 0;
+	double stb_s = time_s([&](const std::vector<uint16_t>& f) {
+		png.clear();
+		stbi_write_png_to_func([](void* context, void* data, int size) {
+			auto out = (std::vector<unsigned char>*)context;
+			out->insert(out->end(), (unsigned char*)data, (unsigned char*)data + size);
+		}, &png, w, h, 2, f.data(), w * 2);
+		return png.size();
+	}, stb_bytes);
+	report("stbi_write_png (2x8)", stb_s, stb_bytes);
+
+	return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) try
+{
+	rs2::log_to_console(RS2_LOG_SEVERITY_ERROR);
+	auto opt = parse(argc, argv);
+	if (opt.spatial_scaling) return spatial_scaling(opt);
+
+	if (!opt.bag.empty())
+	{
+		std::cout << "source      " << opt.bag << std::endl;
+		bag_source source(opt.bag);
+		if (opt.codec_bench) return codec_bench(source, opt);
+		return run(source, opt, source.depth_scale);
+	}
+
+	std::cout << "source      synthetic " << opt.width << "x" << opt.height << std::endl;
+	synthetic_source source(opt.width, opt.height);
+	if (opt.codec_bench) return codec_bench(source, opt);
+	return run(source, opt, 0.001f);
+}
+catch (const rs2::error & e)
+{
+	std::cerr << "RealSense error calling " << e.get_failed_function() << "(" << e.get_failed_args() << "):\n    " << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
+catch (const std::exception& e)
+{
+	std::cerr << e.what() << std::endl;
+	return EXIT_FAILURE;
+}
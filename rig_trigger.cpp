@@ -0,0 +1,218 @@
+// rig_trigger.cpp : capture / average triggers and control commands of a camera_rig
+//
+
+#include "rig_trigger.h"
+#include "control_socket.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+// frames every ring of rig holds, by count and by its byte budget (colorized RGB8 + colour RGB8 + Z16)
+static size_t ring_frames(const camera_rig& rig)
+{
+	size_t frames = (size_t)-1;
+	const size_t snapshot_bytes = (size_t)rig.options().width * rig.options().height * (3 + 3 + 2);
+	for (size_t c = 0; c < rig.size(); c++)
+	{
+		frames = std::min(frames, rig[c].ring().max_frames());
+		if (rig[c].ring().max_bytes()) frames = std::min(frames, rig[c].ring().max_bytes() / snapshot_bytes);
+	}
+	return rig.size() ? frames : 0;
+}
+
+// matched sets one capture of count queues
+static size_t trigger_sets(const trigger_options& opt, unsigned count)
+{
+	if (count > 1) return count;
+	if (opt.best_of_ms > 0) return 1;
+	return (size_t)opt.pre_trigger + opt.post_trigger + 1;
+}
+
+rig_trigger::rig_trigger(camera_rig& rig, capture_writer& writer, const trigger_options& opt)
+	: _rig(rig),
+	_writer(writer),
+	_opt(opt),
+	_timestamper(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()))
+{
+}
+
+size_t rig_trigger::writer_capacity(const camera_rig& rig, const trigger_options& opt, size_t base)
+{
+	const size_t sets = std::max(trigger_sets(opt, 1), ring_frames(rig));
+	return rig.size() * (base + sets * capture_files('d'));
+}
+
+unsigned rig_trigger::max_count() const
+{
+	return (unsigned)std::min<size_t>(ring_frames(_rig), 0xFFFFFFFFu);
+}
+
+std::string rig_trigger::refuse(char key, unsigned count) const
+{
+	std::ostringstream why;
+	const size_t files = trigger_sets(_opt, count) * capture_files(key) * _rig.size();
+	if (count > max_count())
+		why << "capture " << count << " : the rings hold " << max_count() << " frames (--ring-frames, --ring-mb)";
+	else if (files > _writer.capacity())
+		why << "capture " << count << " : " << files << " files, the capture queue takes " << _writer.capacity();
+	return why.str();
+}
+
+std::vector<std::vector<frame_snapshot>> rig_trigger::capture(char key, unsigned count, std::vector<std::string>* queued)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::vector<std::vector<frame_snapshot>> sets;
+	std::string why = refuse(key, count);
+	if (!why.empty())
+	{
+		std::cout << "Capture refused, " << why << std::endl;
+		return sets;
+	}
+	// the files still pending plus these must fit the queue : wait for the writer rather than drop some
+	const size_t files = trigger_sets(_opt, count) * capture_files(key) * _rig.size();
+	if (_writer.pending() + files > _writer.capacity()) _writer.flush();
+
+	double skew_ms = 0;
+	bool tag_frame = false;
+	if (key == 'd') std::cout << "Save Depth performed!" << std::endl;
+	else std::cout << "Save RGB Light-" << key << " performed!" << std::endl;
+	if (count > 1)
+	{
+		sets = _rig.matched_window(0, count - 1, &skew_ms);
+		tag_frame = true;
+		std::cout << "frames T .. T+" << count - 1 << " : " << sets.size() << " saved" << std::endl;
+	}
+	else if (_opt.best_of_ms > 0)
+	{
+		double fill = 0;
+		sets.push_back(_rig.matched_best(_opt.best_of_ms, &fill, &skew_ms));
+		std::cout << "most complete of the last " << _opt.best_of_ms << " ms : frame #" << (sets[0].empty() ? 0 : sets[0][0].frame_number)
+			<< ", depth fill " << (int)(fill * 100) << "%" << std::endl;
+	}
+	else if (_opt.pre_trigger || _opt.post_trigger)
+	{
+		sets = _rig.matched_window(_opt.pre_trigger, _opt.post_trigger, &skew_ms);
+		tag_frame = true;
+		std::cout << "frames T-" << _opt.pre_trigger << " .. T+" << _opt.post_trigger << " : " << sets.size() << " saved" << std::endl;
+	}
+	else
+	{
+		sets.push_back(_rig.matched(&skew_ms));
+	}
+	for (auto& snaps : sets) capture_rig(_rig, snaps, _timestamper, key, _writer, tag_frame, queued);
+	if (_rig.size() > 1) std::cout << "cameras matched within " << skew_ms << " ms" << std::endl;
+	return sets;
+}
+
+std::vector<depth_average_result> rig_trigger::average(unsigned frames, std::vector<std::string>* queued)
+{
+	std::chrono::seconds ts;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		ts = _timestamper;
+	}
+	struct pending_averages
+	{
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::vector<depth_average_result> results;
+		size_t left = 0;
+	};
+	const size_t cameras = _rig.size();
+	auto pending = std::make_shared<pending_averages>();	// outlives a wait that timed out
+	pending->results.resize(cameras);
+	std::cout << "Average of the next " << frames << " depth frames started" << std::endl;
+	for (size_t c = 0; c < cameras; c++)
+	{
+		{
+			std::lock_guard<std::mutex> lock(pending->mutex);
+			pending->left++;
+		}
+		bool started = _rig[c].average().start(frames, _opt.average_min_valid, [pending, c](const depth_average_result& r) {
+			std::lock_guard<std::mutex> lock(pending->mutex);
+			pending->results[c] = r;
+			pending->left--;
+			pending->cv.notify_all();
+		});
+		if (!started)
+		{
+			std::cout << "camera " << _rig[c].serial() << " : an average is already running" << std::endl;
+			std::lock_guard<std::mutex> lock(pending->mutex);
+			pending->left--;
+		}
+	}
+	std::vector<depth_average_result> results;
+	{
+		// twice the stream time plus a margin, then whatever is done
+		std::unique_lock<std::mutex> lock(pending->mutex);
+		pending->cv.wait_for(lock, std::chrono::milliseconds(2000 + 2000ull * frames / std::max(1, _rig.options().fps)),
+			[&]() { return pending->left == 0; });
+		if (pending->left) std::cout << pending->left << " averages not done in time, not captured" << std::endl;
+		results = pending->results;
+	}
+	for (size_t c = 0; c < cameras; c++)
+		if (results[c]) capture_average(results[c], ts, _writer, cameras > 1 ? _rig[c].serial() : std::string(), queued);
+	return results;
+}
+
+long long rig_trigger::new_timestamp()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	//generate timestamper
+	_timestamper = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::system_clock::now().time_since_epoch());
+	std::cout << "current timestamp : " << _timestamper.count() << std::endl;
+	return _timestamper.count();
+}
+
+std::string rig_trigger::command(const std::string& line)
+{
+	control_command cmd = parse_control_command(line);
+	std::ostringstream reply;
+	if (cmd.kind == control_command::capture)
+	{
+		std::string why = refuse(cmd.key, cmd.count);
+		if (!why.empty())
+		{
+			reply << "ERR " << why << "\n";
+			return reply.str();
+		}
+		std::vector<std::string> files;
+		auto failed = _writer.failed();
+		auto sets = capture(cmd.key, cmd.count, &files);
+		_writer.flush();						// acknowledge written files, not queued ones
+		for (auto& snaps : sets)
+			for (size_t i = 0; i < snaps.size() && i < _rig.size(); i++)
+				if (snaps[i]) reply << "frame " << snaps[i].frame_number << " camera " << _rig[i].serial() << "\n";
+		for (auto& file : files) reply << "file " << file << "\n";
+		if (files.empty()) reply << "ERR no frame to capture\n";
+		else if (_writer.failed() != failed) reply << "ERR " << _writer.failed() - failed << " files failed\n";
+		else reply << "OK " << files.size() << " files\n";
+	}
+	else if (cmd.kind == control_command::average)
+	{
+		std::vector<std::string> files;
+		auto failed = _writer.failed();
+		auto results = average(cmd.count, &files);
+		_writer.flush();
+		for (size_t i = 0; i < results.size(); i++)
+			if (results[i])
+				reply << "frames " << results[i].first_frame << " .. " << results[i].last_frame << " camera " << _rig[i].serial()
+					<< " fill " << (int)(results[i].fill * 100) << "% deviation " << results[i].mean_deviation << "\n";
+		for (auto& file : files) reply << "file " << file << "\n";
+		if (files.empty()) reply << "ERR no average completed\n";
+		else if (_writer.failed() != failed) reply << "ERR " << _writer.failed() - failed << " files failed\n";
+		else reply << "OK " << files.size() << " files\n";
+	}
+	else if (cmd.kind == control_command::timestamp) reply << "OK timestamp " << new_timestamp() << "\n";
+	else if (cmd.kind == control_command::quit)
+	{
+		_quit = true;
+		reply << "OK quit\n";
+	}
+	else reply << "ERR unknown command : " << line << "\n";
+	return reply.str();
+}
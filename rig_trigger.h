@@ -0,0 +1,72 @@
+// rig_trigger.h : capture triggers of a camera_rig and the control commands that run them
+//
+// The console key thread, the control socket and replay_bench all trigger
+// through one rig_trigger, so a "capture N" or "average N" takes the same
+// matched sets, file names, limits and replies whoever asks for it.
+//
+// Frames a trigger queues to the capture_writer stay pinned until their
+// files are written, and once the ring has moved on they are no longer
+// covered by the frame pool growth. writer_capacity() sizes the writer queue
+// for the largest single trigger plus a base per camera; a trigger larger
+// than the queue is refused, and one that does not fit next to the files
+// still pending waits for the writer to drain first.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "camera_rig.h"
+#include "capture_writer.h"
+#include "depth_average.h"
+#include "frame_snapshot.h"
+
+struct trigger_options
+{
+	unsigned pre_trigger = 0, post_trigger = 0;	// single captures save frames T-k .. T+k
+	double best_of_ms = 0;					// > 0 : most complete matched set of the last best_of_ms
+	unsigned average_min_valid = 0;			// valid samples of an average pixel, 0 = half the frames
+};
+
+class rig_trigger
+{
+public:
+	rig_trigger(camera_rig& rig, capture_writer& writer, const trigger_options& opt);
+
+	// writer queue for the largest trigger of rig (every set of a window or of the longest "capture N"
+	// the rings hold, depth files on every camera) on top of base files per camera
+	static size_t writer_capacity(const camera_rig& rig, const trigger_options& opt, size_t base);
+
+	// largest "capture N" : the frames every ring holds, by count and by its byte budget
+	unsigned max_count() const;
+
+	// empty when a capture of count sets of key can run, else why not
+	std::string refuse(char key, unsigned count) const;
+
+	// a matched snapshot of every camera from the pre-trigger rings, or the window / best set of
+	// trigger_options; count > 1 saves the sets of count consecutive frames from the trigger on.
+	// Returns the sets it queued, none when refused
+	std::vector<std::vector<frame_snapshot>> capture(char key, unsigned count, std::vector<std::string>* queued = nullptr);
+
+	// every camera averages its next frames raw depth frames on its own averaging thread, then the
+	// results are queued like a capture. Blocks until the averages are done; one result per camera
+	std::vector<depth_average_result> average(unsigned frames, std::vector<std::string>* queued = nullptr);
+
+	long long new_timestamp();				// seconds of the file names from now on
+
+	// control_socket::command_handler : runs one command line, returns the reply
+	std::string command(const std::string& line);
+	bool quit_requested() const { return _quit; }
+
+private:
+	camera_rig& _rig;
+	capture_writer& _writer;
+	const trigger_options _opt;
+
+	std::mutex _mutex;						// one trigger at a time, guards _timestamper
+	std::chrono::seconds _timestamper;		// file namer
+	std::atomic<bool> _quit{ false };
+};
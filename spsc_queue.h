@@ -0,0 +1,110 @@
+// spsc_queue.h : bounded single-producer / single-consumer queue between pipeline stages
+//
+// Ring of fixed capacity, lock-free while neither side has to wait. A side
+// that finds the ring full (producer) or empty (consumer) sleeps on a
+// condition variable; the other side only takes the mutex to wake it when a
+// sleeper is registered. Items come out in the order they went in, so a
+// stage that runs on one thread keeps the frame order of its input.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+template<class T>
+class spsc_queue
+{
+public:
+	explicit spsc_queue(size_t capacity) : _slots(capacity ? capacity : 1) {}
+
+	// producer : blocks while full, false once the queue is closed
+	bool push(T item)
+	{
+		for (;;)
+		{
+			if (_closed) return false;
+			if (try_push(item)) { wake(); return true; }
+			sleep([this]() { return _closed || size() < capacity(); });
+		}
+	}
+
+	// producer : never blocks, false when full or closed (the item is not taken)
+	bool offer(T item)
+	{
+		if (_closed || !try_push(item)) return false;
+		wake();
+		return true;
+	}
+
+	// consumer : blocks while empty, false once closed and drained
+	bool pop(T& item)
+	{
+		for (;;)
+		{
+			if (try_pop(item)) { wake(); return true; }
+			if (_closed) return false;
+			sleep([this]() { return _closed || size() > 0; });
+		}
+	}
+
+	// wakes both sides; push fails from now on, pop drains what is left
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_closed = true;
+		_cv.notify_all();
+	}
+
+	size_t size() const { return _tail.load() - _head.load(); }
+	size_t capacity() const { return _slots.size(); }
+
+private:
+	// _head / _tail / _sleepers are sequentially consistent : a side that registers as a
+	// sleeper and then re-checks the ring cannot miss the other side's update, or the
+	// other side sees the sleeper and wakes it under the mutex
+	bool try_push(T& item)
+	{
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail - _head.load() == _slots.size()) return false;
+		_slots[tail % _slots.size()] = std::move(item);
+		_tail.store(tail + 1);
+		return true;
+	}
+
+	bool try_pop(T& item)
+	{
+		size_t head = _head.load(std::memory_order_relaxed);
+		if (_tail.load() == head) return false;
+		item = std::move(_slots[head % _slots.size()]);
+		_slots[head % _slots.size()] = T();	// drop the reference now, not when the slot is reused
+		_head.store(head + 1);
+		return true;
+	}
+
+	template<class Ready>
+	void sleep(Ready ready)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_sleepers++;
+		_cv.wait(lock, ready);
+		_sleepers--;
+	}
+
+	void wake()
+	{
+		if (!_sleepers) return;
+		std::lock_guard<std::mutex> lock(_mutex);
+		_cv.notify_all();
+	}
+
+	std::vector<T> _slots;
+	std::atomic<size_t> _head{ 0 };			// next slot to pop, consumer owned
+	std::atomic<size_t> _tail{ 0 };			// next slot to push, producer owned
+	std::atomic<int> _sleepers{ 0 };
+	std::atomic<bool> _closed{ false };
+	std::mutex _mutex;
+	std::condition_variable _cv;
+};
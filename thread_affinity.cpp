@@ -0,0 +1,60 @@
+// thread_affinity.cpp : pin threads to a set of logical cores
+//
+
+#include "thread_affinity.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+bool pin_current_thread(const std::vector<unsigned>& cores)
+{
+	if (cores.empty()) return true;
+#ifdef _WIN32
+	DWORD_PTR mask = 0;
+	for (unsigned c : cores)
+		if (c < sizeof(DWORD_PTR) * 8) mask |= (DWORD_PTR)1 << c;	// first processor group only
+	return mask && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (unsigned c : cores)
+		if (c < CPU_SETSIZE) CPU_SET(c, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+std::vector<unsigned> parse_core_list(const std::string& list)
+{
+	std::vector<unsigned> cores;
+	std::stringstream ss(list);
+	std::string part;
+	while (std::getline(ss, part, ','))
+	{
+		if (part.empty()) continue;
+		size_t dash = part.find('-');
+		int first = atoi(part.substr(0, dash).c_str());
+		int last = dash == std::string::npos ? first : atoi(part.substr(dash + 1).c_str());
+		for (int c = std::max(0, first); c <= last; c++) cores.push_back((unsigned)c);
+	}
+	return cores;
+}
+
+std::vector<unsigned> split_cores(unsigned index, unsigned count)
+{
+	unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+	if (!count || count > hw) return std::vector<unsigned>();	// fewer cores than cameras : share them
+	std::vector<unsigned> cores;
+	for (unsigned c = hw * index / count; c < hw * (index + 1) / count; c++) cores.push_back(c);
+	return cores;
+}
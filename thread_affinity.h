@@ -0,0 +1,20 @@
+// thread_affinity.h : pin threads to a set of logical cores
+//
+// With several cameras in one process every camera gets its own cores, so the
+// feeding thread, the pipeline stages and the spatial filter pool of one
+// camera do not migrate onto another camera's cores and thrash its caches.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// pins the calling thread to cores (logical processor numbers), no-op for an empty set;
+// false when the OS refused
+bool pin_current_thread(const std::vector<unsigned>& cores);
+
+// "0,1,4-7" -> { 0, 1, 4, 5, 6, 7 }; malformed parts are skipped
+std::vector<unsigned> parse_core_list(const std::string& list);
+
+// the cores of camera index of count when the hardware threads are split evenly
+std::vector<unsigned> split_cores(unsigned index, unsigned count);
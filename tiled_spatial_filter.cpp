@@ -0,0 +1,234 @@
+// tiled_spatial_filter.cpp : multi-threaded edge-preserving spatial filter
+//
+
+#include "tiled_spatial_filter.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static const int column_block = 64;		// columns filtered in lockstep, one cache line of state each
+
+// rs2 treats a disparity sample as valid when its bit pattern is a positive int
+static inline bool valid(float v)
+{
+	int32_t i;
+	memcpy(&i, &v, sizeof(i));
+	return i > 0;
+}
+
+static inline bool empty(float v)
+{
+	int32_t i;
+	memcpy(&i, &v, sizeof(i));
+	return i == 0;
+}
+
+// One step of the recursive filter. prev is the unfiltered previous sample, state the
+// running output; the sample is blended only if both are valid and close. Written without
+// branches so the column loop vectorises; the arithmetic is the same as rs2's.
+static inline void step(float& sample, float& state, float& prev, float alpha, float delta)
+{
+	const float x = sample;
+	const float d = prev - x;
+	const bool vx = valid(x);
+	const bool smooth = vx && valid(prev) && d < delta && d > -delta;
+	const float filtered = x * alpha + state * (1.0f - alpha);
+	sample = smooth ? filtered : x;
+	state = smooth ? filtered : (vx ? x : state);
+	prev = x;
+}
+
+static void smooth_row(float* row, int width, float alpha, float delta)
+{
+	float state = row[0], prev = row[0];
+	for (int x = 1; x < width; x++) step(row[x], state, prev, alpha, delta);
+	state = prev = row[width - 1];
+	for (int x = width - 2; x >= 0; x--) step(row[x], state, prev, alpha, delta);
+}
+
+// columns [x0, x1), top to bottom then bottom to top
+static void smooth_columns(float* image, int stride, int height, int x0, int x1, float alpha, float delta)
+{
+	float state[column_block], prev[column_block];
+	for (int c0 = x0; c0 < x1; c0 += column_block)
+	{
+		const int n = std::min(column_block, x1 - c0);
+		float* top = image + c0;
+		for (int c = 0; c < n; c++) state[c] = prev[c] = top[c];
+		for (int y = 1; y < height; y++)
+		{
+			float* r = top + (size_t)y * stride;
+			for (int c = 0; c < n; c++) step(r[c], state[c], prev[c], alpha, delta);
+		}
+		float* bottom = top + (size_t)(height - 1) * stride;
+		for (int c = 0; c < n; c++) state[c] = prev[c] = bottom[c];
+		for (int y = height - 2; y >= 0; y--)
+		{
+			float* r = top + (size_t)y * stride;
+			for (int c = 0; c < n; c++) step(r[c], state[c], prev[c], alpha, delta);
+		}
+	}
+}
+
+// rs2 hole filling (disparity domain) : copy the left, then the right neighbour into
+// up to radius - 1 consecutive empty samples. Like rs2, the right to left pass covers
+// samples width - 1 .. 1 and takes the right neighbour of the last one from the start
+// of the next row (next_first, 0 on the last row); sample 0 is never filled.
+static void fill_row(float* row, int width, int radius, float next_first)
+{
+	int run = 0;
+	for (int x = 1; x < width; x++)
+	{
+		if (empty(row[x])) { if (++run < radius) row[x] = row[x - 1]; }
+		else run = 0;
+	}
+	run = 0;
+	for (int x = width - 1; x >= 1; x--)
+	{
+		if (empty(row[x])) { if (++run < radius) row[x] = x + 1 < width ? row[x + 1] : next_first; }
+		else run = 0;
+	}
+}
+
+tiled_spatial_filter::tiled_spatial_filter(unsigned threads)
+	: _pool(new work_stealing_pool(threads))
+{
+}
+
+void tiled_spatial_filter::set_options(float alpha, float delta, int iterations, int holes_fill)
+{
+	_alpha = alpha;
+	_delta = delta;
+	_iterations = std::max(1, iterations);
+	holes_fill = std::min(5, std::max(0, holes_fill));
+	_fill_radius = !holes_fill ? 0 : holes_fill == 5 ? 0xff : 1 << holes_fill;
+}
+
+void tiled_spatial_filter::set_threads(unsigned threads, const std::vector<unsigned>& cores)
+{
+	_pool.reset();							// join the old helpers first
+	_pool.reset(new work_stealing_pool(threads, cores));
+}
+
+void tiled_spatial_filter::set_tile(int width, int height, int halo)
+{
+	_tile_w = std::max(16, width);
+	_tile_h = std::max(16, height);
+	_halo = std::max(0, halo);
+}
+
+const char* tiled_spatial_filter::mode_name(mode_type m)
+{
+	return m == mode_tiled ? "tiled" : "exact";
+}
+
+void tiled_spatial_filter::filter_serial(float* image, int width, int height, int stride_bytes) const
+{
+	const int stride = stride_bytes / (int)sizeof(float);
+	for (int i = 0; i < _iterations; i++)
+	{
+		for (int y = 0; y < height; y++) smooth_row(image + (size_t)y * stride, width, _alpha, _delta);
+		smooth_columns(image, stride, height, 0, width, _alpha, _delta);
+	}
+	if (_fill_radius)
+		for (int y = 0; y < height; y++)
+			fill_row(image + (size_t)y * stride, width, _fill_radius, y + 1 < height ? image[(size_t)(y + 1) * stride] : 0.f);
+}
+
+void tiled_spatial_filter::filter(const float* src, int src_stride_bytes, float* dst, int dst_stride_bytes,
+	int width, int height)
+{
+	if (width < 2 || height < 2) return;
+	const int src_stride = src_stride_bytes / (int)sizeof(float);
+	const int stride = dst_stride_bytes / (int)sizeof(float);
+	const int participants = (int)_pool->threads();
+
+	if (_mode == mode_tiled)
+	{
+		const int tiles_x = (width + _tile_w - 1) / _tile_w, tiles_y = (height + _tile_h - 1) / _tile_h;
+		_pool->run(tiles_x * tiles_y, [&](int t) {
+			const int x0 = (t % tiles_x) * _tile_w, y0 = (t / tiles_x) * _tile_h;
+			const int x1 = std::min(width, x0 + _tile_w), y1 = std::min(height, y0 + _tile_h);
+			const int hx0 = std::max(0, x0 - _halo), hy0 = std::max(0, y0 - _halo);
+			const int hx1 = std::min(width, x1 + _halo), hy1 = std::min(height, y1 + _halo);
+			const int w = hx1 - hx0, h = hy1 - hy0;
+
+			thread_local std::vector<float> scratch;
+			scratch.resize((size_t)w * h);
+			for (int y = 0; y < h; y++)
+				memcpy(&scratch[(size_t)y * w], src + (size_t)(hy0 + y) * src_stride + hx0, (size_t)w * sizeof(float));
+			filter_serial(scratch.data(), w, h, w * (int)sizeof(float));
+			for (int y = y0; y < y1; y++)
+				memcpy(dst + (size_t)y * stride + x0, &scratch[(size_t)(y - hy0) * w + (x0 - hx0)],
+					(size_t)(x1 - x0) * sizeof(float));
+		});
+		return;
+	}
+
+	for (int y = 0; y < height; y++)
+		memcpy(dst + (size_t)y * stride, src + (size_t)y * src_stride, (size_t)width * sizeof(float));
+
+	// a few tasks per participant so stealing can even out uneven cores
+	const int row_tasks = std::min(height, participants * 4);
+	const int column_tasks = std::min((width + column_block - 1) / column_block, participants * 4);
+	auto rows = [&](int t, int& y0, int& y1) {
+		y0 = (int)((long long)height * t / row_tasks);
+		y1 = (int)((long long)height * (t + 1) / row_tasks);
+	};
+	for (int i = 0; i < _iterations; i++)
+	{
+		_pool->run(row_tasks, [&](int t) {
+			int y0, y1;
+			rows(t, y0, y1);
+			for (int y = y0; y < y1; y++) smooth_row(dst + (size_t)y * stride, width, _alpha, _delta);
+		});
+		_pool->run(column_tasks, [&](int t) {
+			// strips on column_block boundaries so the lockstep blocks stay full
+			const int blocks = (width + column_block - 1) / column_block;
+			const int x0 = (int)((long long)blocks * t / column_tasks) * column_block;
+			const int x1 = std::min(width, (int)((long long)blocks * (t + 1) / column_tasks) * column_block);
+			smooth_columns(dst, stride, height, x0, x1, _alpha, _delta);
+		});
+	}
+	if (_fill_radius)
+	{
+		_pool->run(row_tasks, [&](int t) {
+			int y0, y1;
+			rows(t, y0, y1);
+			for (int y = y0; y < y1; y++)	// sample 0 of the next row is never written, any band order is fine
+				fill_row(dst + (size_t)y * stride, width, _fill_radius, y + 1 < height ? dst[(size_t)(y + 1) * stride] : 0.f);
+		});
+	}
+}
+
+rs2::frame tiled_spatial_filter::process(const rs2::frame& disparity, const rs2::frame_source& source)
+{
+	auto in = disparity.as<rs2::video_frame>();
+	if (!in || in.get_profile().format() != RS2_FORMAT_DISPARITY32) return rs2::frame();
+
+	const int w = in.get_width(), h = in.get_height();
+	auto out = source.allocate_video_frame(in.get_profile(), in, 4, w, h, w * 4, RS2_EXTENSION_DISPARITY_FRAME)
+		.as<rs2::video_frame>();
+	filter((const float*)in.get_data(), in.get_stride_in_bytes(), (float*)out.get_data(), out.get_stride_in_bytes(), w, h);
+	return out;
+}
+
+long long tiled_spatial_filter::compare(const rs2::video_frame& a, const rs2::video_frame& b)
+{
+	if (!a || !b || a.get_width() != b.get_width() || a.get_height() != b.get_height() ||
+		a.get_bytes_per_pixel() != 4 || b.get_bytes_per_pixel() != 4)
+		return -1;
+
+	long long diff = 0;
+	const int w = a.get_width();
+	for (int y = 0; y < a.get_height(); y++)
+	{
+		auto pa = (const uint32_t*)((const uint8_t*)a.get_data() + (size_t)y * a.get_stride_in_bytes());
+		auto pb = (const uint32_t*)((const uint8_t*)b.get_data() + (size_t)y * b.get_stride_in_bytes());
+		if (!memcmp(pa, pb, (size_t)w * 4)) continue;
+		for (int x = 0; x < w; x++) diff += pa[x] != pb[x];
+	}
+	return diff;
+}
@@ -0,0 +1,66 @@
+// tiled_spatial_filter.h : multi-threaded edge-preserving spatial filter
+//
+// Same filter as rs2::spatial_filter on a disparity (32 bit float) frame :
+// per iteration a recursive left->right / right->left pass over every row,
+// then top->bottom / bottom->top over every column, blending a sample with
+// the running state when it differs from its predecessor by less than delta;
+// then the row-wise hole filling of RS2_OPTION_HOLES_FILL 1..5. The work is
+// split over a work_stealing_pool :
+//
+//   mode_exact : row bands and column strips, one pool run per pass. Every
+//                row / column is still filtered start to end, so the output
+//                is bit-identical to the serial filter for any thread count
+//                (the deterministic mode, and the one checked against
+//                rs2::spatial_filter by depth_pipeline).
+//   mode_tiled : 2-D tiles with a halo; each tile runs all iterations in a
+//                cache-sized scratch and keeps its core. Output depends on
+//                the tile and halo size only (not on threads or scheduling)
+//                and differs from the serial filter close to tile seams.
+
+#pragma once
+
+#include <librealsense2/rs.hpp>
+
+#include <memory>
+#include <vector>
+
+#include "work_stealing_pool.h"
+
+class tiled_spatial_filter
+{
+public:
+	enum mode_type { mode_exact, mode_tiled };
+
+	// threads : pool size including the calling thread, 0 = one per hardware thread
+	explicit tiled_spatial_filter(unsigned threads = 0);
+
+	// same meaning as the rs2::spatial_filter options (alpha, delta, magnitude, holes fill)
+	void set_options(float alpha, float delta, int iterations, int holes_fill);
+	void set_threads(unsigned threads, const std::vector<unsigned>& cores = std::vector<unsigned>());
+	void set_mode(mode_type m) { _mode = m; }
+	void set_tile(int width, int height, int halo);	// mode_tiled only
+	mode_type mode() const { return _mode; }
+	unsigned threads() const { return _pool->threads(); }
+	static const char* mode_name(mode_type m);
+
+	// RS2_FORMAT_DISPARITY32 frame in, filtered frame from source out;
+	// an empty frame for any other format
+	rs2::frame process(const rs2::frame& disparity, const rs2::frame_source& source);
+
+	// raw path : src is not modified, dst is width x height floats
+	void filter(const float* src, int src_stride_bytes, float* dst, int dst_stride_bytes, int width, int height);
+
+	// single-threaded reference, in place
+	void filter_serial(float* image, int width, int height, int stride_bytes) const;
+
+	// number of pixels whose 32 bit values differ, -1 if not comparable
+	static long long compare(const rs2::video_frame& a, const rs2::video_frame& b);
+
+private:
+	float _alpha = 0.5f, _delta = 20.f;
+	int _iterations = 2;
+	int _fill_radius = 0;					// 0 = no hole filling
+	mode_type _mode = mode_exact;
+	int _tile_w = 320, _tile_h = 120, _halo = 16;
+	std::unique_ptr<work_stealing_pool> _pool;
+};
@@ -0,0 +1,115 @@
+// work_stealing_pool.cpp : fork / join pool for per-frame data-parallel stages
+//
+
+#include "work_stealing_pool.h"
+#include "thread_affinity.h"
+
+work_stealing_pool::work_stealing_pool(unsigned threads, const std::vector<unsigned>& cores)
+{
+	if (!threads) threads = std::thread::hardware_concurrency();
+	if (!threads) threads = 1;
+	for (unsigned i = 0; i < threads; i++)
+		_queues.emplace_back(new task_queue);
+	for (unsigned i = 1; i < threads; i++)
+		_helpers.emplace_back([this, i, cores]() {
+			pin_current_thread(cores);
+			worker(i);
+		});
+}
+
+work_stealing_pool::~work_stealing_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wake_cv.notify_all();
+	for (auto& t : _helpers) t.join();
+}
+
+void work_stealing_pool::run(int count, const std::function<void(int)>& fn)
+{
+	if (count <= 0) return;
+	if (count == 1 || _queues.size() == 1)
+	{
+		for (int i = 0; i < count; i++) fn(i);
+		return;
+	}
+
+	// _fn is written before any task is queued; a participant only reads it after
+	// taking a task through a queue mutex, and run() does not return before the last task
+	_fn = &fn;
+	_remaining = count;
+	const int n = (int)_queues.size();
+	for (int q = 0; q < n; q++)
+	{
+		int begin = (int)((long long)count * q / n), end = (int)((long long)count * (q + 1) / n);
+		std::lock_guard<std::mutex> lock(_queues[q]->mutex);
+		for (int i = begin; i < end; i++) _queues[q]->tasks.push_back(i);
+	}
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_generation++;
+	}
+	_wake_cv.notify_all();
+
+	int task;
+	while (next_task(0, task)) execute(task);
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	_done_cv.wait(lock, [this]() { return _remaining == 0; });
+}
+
+bool work_stealing_pool::next_task(unsigned index, int& task)
+{
+	{
+		auto& own = *_queues[index];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty())
+		{
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+	const unsigned n = (unsigned)_queues.size();
+	for (unsigned k = 1; k < n; k++)
+	{
+		auto& victim = *_queues[(index + k) % n];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty())
+		{
+			task = victim.tasks.front();
+			victim.tasks.pop_front();
+			_steals++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void work_stealing_pool::execute(int task)
+{
+	(*_fn)(task);
+	if (_remaining.fetch_sub(1) == 1)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_done_cv.notify_all();
+	}
+}
+
+void work_stealing_pool::worker(unsigned index)
+{
+	unsigned long long seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake_cv.wait(lock, [&]() { return _stopping || _generation != seen; });
+			if (_stopping) return;
+			seen = _generation;
+		}
+		int task;
+		while (next_task(index, task)) execute(task);
+	}
+}
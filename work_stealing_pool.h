@@ -0,0 +1,58 @@
+// work_stealing_pool.h : fork / join pool for per-frame data-parallel stages
+//
+// run(count, fn) calls fn(0) .. fn(count - 1) and returns when all are done.
+// Tasks are dealt out in contiguous blocks, one deque per participant, so
+// neighbouring tiles stay on one core; a participant that runs dry steals
+// from the front of another's deque. The calling thread works too, so a pool
+// of N threads starts N - 1 helpers.
+//
+// run() is not reentrant : one caller at a time (the processing thread).
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class work_stealing_pool
+{
+public:
+	// threads : participants including the caller, 0 = one per hardware thread;
+	// cores : helpers are pinned to these (the caller pins itself), empty = not pinned
+	explicit work_stealing_pool(unsigned threads = 0, const std::vector<unsigned>& cores = std::vector<unsigned>());
+	~work_stealing_pool();
+
+	void run(int count, const std::function<void(int)>& fn);
+
+	unsigned threads() const { return (unsigned)_queues.size(); }
+	unsigned long long steals() const { return _steals; }
+
+private:
+	struct task_queue
+	{
+		std::mutex mutex;
+		std::deque<int> tasks;
+	};
+
+	void worker(unsigned index);
+	bool next_task(unsigned index, int& task);		// own back first, then steal a front
+	void execute(int task);
+
+	std::vector<std::unique_ptr<task_queue>> _queues;	// [0] = caller
+	std::vector<std::thread> _helpers;
+
+	std::mutex _mutex;
+	std::condition_variable _wake_cv;		// new generation / stopping
+	std::condition_variable _done_cv;		// _remaining reached zero
+	unsigned long long _generation = 0;
+	bool _stopping = false;
+
+	const std::function<void(int)>* _fn = nullptr;	// valid while tasks of this run remain
+	std::atomic<int> _remaining{ 0 };
+	std::atomic<unsigned long long> _steals{ 0 };
+};